@@ -6,6 +6,10 @@
  */
 
 #include "TQueue.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
 
  /** \brief Úplná definice privátního typu QueueNode
   *  \details Privátní typ QueueNode (nedostupný mimo funkce ze souboru TQueue.c) reprezentuje typ pro jednotlivé uzly lineárního jednosměrně vázaného seznamu.
@@ -21,11 +25,119 @@ void queue_init(struct TQueue* aQueue)
 	// Prvotní nastavení vnitřních proměnných fronty.
 	// Pokud parametr typu ukazatel na TQueue není NULL,
 	// nastav vnitřní složky odkazující na počáteční a koncový uzel na hodnotu NULL.
+	queue_init_bounded(aQueue, 0, QUEUE_OVERFLOW_BLOCK);
+}
+
+void queue_init_bounded(struct TQueue* aQueue, size_t aCapacity, enum TQueueOverflowPolicy aPolicy)
+{
+	// Prvotní nastavení vnitřních proměnných fronty s omezenou kapacitou.
+	// Pokud parametr typu ukazatel na TQueue není NULL,
+	// nastav vnitřní složky odkazující na počáteční a koncový uzel na hodnotu NULL,
+	// vynuluj počitadla a ulož kapacitu a politiku fronty.
 	if (aQueue) {
 		aQueue->iBack = NULL;
 		aQueue->iFront = NULL;
+		aQueue->iCount = 0;
+		aQueue->iCapacity = aCapacity;
+		aQueue->iPolicy = aPolicy;
+		aQueue->iDropped = 0;
+		aQueue->iFree = NULL;
+		aQueue->iFreeCount = 0;
+		aQueue->iReserved = 0;
 	}
+}
 
+bool queue_reserve(struct TQueue* aQueue, size_t aCount)
+{
+	// Předalokace uzlů do seznamu volných uzlů.
+	// Pokud parametr typu ukazatel na TQueue není NULL,
+	// ulož požadovaný počet uzlů, uvolni volné uzly nad tento počet
+	// a chybějící uzly alokuj a zařaď na začátek seznamu volných uzlů.
+	// Pokud se alokace některého uzlu nepovedla, vrať false, jinak vrať true.
+	if (aQueue) {
+		aQueue->iReserved = aCount;
+		while (aQueue->iFree && aQueue->iCount + aQueue->iFreeCount > aCount) {
+			struct TQueueNode* desnode = aQueue->iFree;
+			aQueue->iFree = desnode->iNext;
+			aQueue->iFreeCount--;
+			free(desnode);
+		}
+		while (aQueue->iCount + aQueue->iFreeCount < aCount) {
+			struct TQueueNode* newnode = malloc(sizeof(struct TQueueNode));
+			if (newnode == NULL) {
+				return false;
+			}
+			newnode->iNext = aQueue->iFree;
+			aQueue->iFree = newnode;
+			aQueue->iFreeCount++;
+		}
+		return true;
+	}
+	return false;
+}
+
+void queue_set_policy(struct TQueue* aQueue, enum TQueueOverflowPolicy aPolicy)
+{
+	// Změna politiky fronty, počitadlo zahozených elementů zůstává zachováno.
+	if (aQueue) {
+		aQueue->iPolicy = aPolicy;
+	}
+}
+
+/** \brief Vrácení uzlu fronty
+ *  \details Privátní funkce vrátí uzel odpojený ze seznamu do seznamu volných uzlů, pokud fronta nevlastní více uzlů, než kolik jich má rezervováno, jinak jej dealokuje.
+ */
+static void queue_release_node(struct TQueue* aQueue, struct TQueueNode* aNode)
+{
+	if (aQueue->iCount + aQueue->iFreeCount < aQueue->iReserved) {
+		aNode->iNext = aQueue->iFree;
+		aQueue->iFree = aNode;
+		aQueue->iFreeCount++;
+	}
+	else {
+		free(aNode);
+	}
+}
+
+size_t queue_set_capacity(struct TQueue* aQueue, size_t aCapacity)
+{
+	// Změna kapacity fronty.
+	// Pokud parametr typu ukazatel na TQueue není NULL, ulož novou kapacitu.
+	// Pokud fronta obsahuje více elementů, než nová kapacita dovoluje, uplatni na přebývající elementy politiku fronty:
+	// BLOCK elementy ponechá (další vkládání selže, dokud jejich počet neklesne pod kapacitu),
+	// DROP_OLDEST a COALESCE odeberou přebývající elementy z čela fronty (zůstanou nejnovější hodnoty),
+	// DROP_NEWEST odebere přebývající elementy z konce fronty.
+	// Odebrané elementy započítej do počitadla zahozených elementů a vrať jejich počet.
+	if (aQueue) {
+		aQueue->iCapacity = aCapacity;
+		if (aCapacity == 0 || aQueue->iCount <= aCapacity || aQueue->iPolicy == QUEUE_OVERFLOW_BLOCK) {
+			return 0;
+		}
+		const size_t dropped = aQueue->iCount - aCapacity;
+		if (aQueue->iPolicy == QUEUE_OVERFLOW_DROP_NEWEST) {
+			struct TQueueNode* lastnode = aQueue->iFront;
+			for (size_t i = 1; i < aCapacity; i++) {
+				lastnode = lastnode->iNext;
+			}
+			struct TQueueNode* actnode = lastnode->iNext;
+			lastnode->iNext = NULL;
+			aQueue->iBack = lastnode;
+			aQueue->iCount = aCapacity;
+			while (actnode != NULL) {
+				struct TQueueNode* desnode = actnode;
+				actnode = actnode->iNext;
+				queue_release_node(aQueue, desnode);
+			}
+		}
+		else {
+			while (aQueue->iCount > aCapacity) {
+				queue_pop(aQueue);
+			}
+		}
+		aQueue->iDropped += dropped;
+		return dropped;
+	}
+	return 0;
 }
 
 bool queue_is_empty(const struct TQueue* aQueue)
@@ -40,6 +152,36 @@ bool queue_is_empty(const struct TQueue* aQueue)
 	return true;
 }
 
+bool queue_is_full(const struct TQueue* aQueue)
+{
+	// Test, zda omezená fronta dosáhla své kapacity.
+	// Neomezená fronta (kapacita 0) není nikdy plná.
+	if (aQueue && aQueue->iCapacity && aQueue->iCount >= aQueue->iCapacity) {
+		return true;
+	}
+	return false;
+}
+
+size_t queue_size(const struct TQueue* aQueue)
+{
+	return aQueue ? aQueue->iCount : 0;
+}
+
+size_t queue_capacity(const struct TQueue* aQueue)
+{
+	return aQueue ? aQueue->iCapacity : 0;
+}
+
+size_t queue_dropped(const struct TQueue* aQueue)
+{
+	return aQueue ? aQueue->iDropped : 0;
+}
+
+enum TQueueOverflowPolicy queue_policy(const struct TQueue* aQueue)
+{
+	return aQueue ? aQueue->iPolicy : QUEUE_OVERFLOW_BLOCK;
+}
+
 bool /* TQueueIterator */ queue_front(const struct TQueue* aQueue, TQueueElement* aValue)
 {
 	// Do paměti předané pomocí druhého parametru zapíše kopii elementu z čela fronty.
@@ -78,9 +220,37 @@ bool queue_push(struct TQueue* aQueue, TQueueElement aValue)
 	// Nastav ukazatel iBack na nový (posledně přidaný) uzel.
 	// Pokud operace skončila úspěšně, vrať true,
 	// jinak vrať false.
+	// Je-li k dispozici předalokovaný volný uzel, použij jej místo alokace.
+	// Je-li omezená fronta plná, uplatni nejprve její politiku:
+	// BLOCK a DROP_NEWEST element nevloží (DROP_NEWEST jej započítá jako zahozený),
+	// COALESCE přepíše element na konci fronty, DROP_OLDEST odebere element z čela fronty.
 	if (aQueue) {
+		if (queue_is_full(aQueue)) {
+			switch (aQueue->iPolicy) {
+			case QUEUE_OVERFLOW_BLOCK:
+				return false;
+			case QUEUE_OVERFLOW_DROP_NEWEST:
+				aQueue->iDropped++;
+				return false;
+			case QUEUE_OVERFLOW_COALESCE:
+				aQueue->iBack->iValue = aValue;
+				aQueue->iDropped++;
+				return true;
+			case QUEUE_OVERFLOW_DROP_OLDEST:
+				queue_pop(aQueue);
+				aQueue->iDropped++;
+				break;
+			}
+		}
 		struct TQueueNode* newnode = NULL;
-		newnode = malloc(sizeof(struct TQueueNode));
+		if (aQueue->iFree) {
+			newnode = aQueue->iFree;
+			aQueue->iFree = newnode->iNext;
+			aQueue->iFreeCount--;
+		}
+		else {
+			newnode = malloc(sizeof(struct TQueueNode));
+		}
 		if (newnode == NULL) {
 			return false;
 		}
@@ -94,6 +264,7 @@ bool queue_push(struct TQueue* aQueue, TQueueElement aValue)
 			aQueue->iBack->iNext = newnode;
 			aQueue->iBack = newnode;
 		}
+		aQueue->iCount++;
 		return true;
 	}
 	return false;
@@ -106,7 +277,8 @@ bool queue_pop(struct TQueue* aQueue)
 	// zapamatuj si v dočasné proměnné odkaz na počáteční uzel seznamu,
 	// jako nový počátek fronty zapiš druhý uzel seznamu.
 	// Pokud fronta obsahovala pouze seznam s jedním uzlem (počátek je nyní NULL) vynuluj i ukazatel konce seznamu,
-	// dealokuj paměť zapamatovaného bývalého prvního uzlu.
+	// dealokuj paměť zapamatovaného bývalého prvního uzlu,
+	// nebo jej vrať do seznamu volných uzlů, pokud fronta nevlastní více uzlů, než kolik jich má rezervováno.
 	// Pokud operace skončila úspěšně, vrať true,
 	// jinak vrať false.
 
@@ -116,7 +288,8 @@ bool queue_pop(struct TQueue* aQueue)
 		if (aQueue->iFront == NULL) {
 			aQueue->iBack = NULL;
 		}
-		free(firstnode);
+		aQueue->iCount--;
+		queue_release_node(aQueue, firstnode);
 		return true;
 	}
 	return false;
@@ -132,11 +305,23 @@ void queue_destroy(struct TQueue* aQueue)
 	// zapamatuj si odkaz na rušený uzel,
 	// nastav aktuální uzel na následující uzel,
 	// odalokuj rušený uzel pomocí zapamatovaného odkazu.
+	// Stejně uvolni i seznam volných uzlů a zruš rezervaci.
 	if (aQueue) {
 		struct TQueueNode* actnode = aQueue->iFront;
 		struct TQueueNode* desnode = NULL;
 		aQueue->iBack = NULL;
 		aQueue->iFront = NULL;
+		aQueue->iCount = 0;
+		aQueue->iDropped = 0;
+		while (actnode != NULL) {
+			desnode = actnode;
+			actnode = actnode->iNext;
+			free(desnode);
+		}
+		actnode = aQueue->iFree;
+		aQueue->iFree = NULL;
+		aQueue->iFreeCount = 0;
+		aQueue->iReserved = 0;
 		while (actnode != NULL) {
 			desnode = actnode;
 			actnode = actnode->iNext;
@@ -211,14 +396,10 @@ TQueueElement queue_iterator_value(const struct TQueueIterator* aIter)
 	// Vrátí hodnotu elementu, na kterou odkazuje iterátor.
 	// Pokud je iterátor validní, vrať hodnotu aktuálního elementu,
 	// jinak vrať nulový element.
-	if (aIter) {
-		if (queue_iterator_is_valid(aIter)) {
-			return aIter->iActual->iValue;	return (TQueueElement) { aIter->iActual->iValue };
-		}
-		else {
-			return aIter->iActual->iValue;	return (TQueueElement) { 0 };
-		}
+	if (queue_iterator_is_valid(aIter)) {
+		return aIter->iActual->iValue;
 	}
+	return (TQueueElement) { 0 };
 }
 
 bool queue_iterator_set_value(const struct TQueueIterator* aIter, TQueueElement aValue)
@@ -233,3 +414,319 @@ bool queue_iterator_set_value(const struct TQueueIterator* aIter, TQueueElement
 	}
 	return false;
 }
+
+/** \brief Úsek fronty zpracovávaný jedním vláknem paralelního algoritmu
+ */
+struct TQueueJob
+{
+	const struct TQueue* iQueue;			///< Zpracovávaná fronta
+	struct TQueueNode* iStart;				///< První uzel úseku
+	size_t iLength;							///< Počet elementů úseku
+	bool(*iPredicate)(const struct TQueueIterator* aIter);		///< Predikát (count_if, partition)
+	TQueueElement(*iTransform)(TQueueElement aValue);			///< Operace (transform)
+	long long(*iReduce)(long long aAcc, TQueueElement aValue);	///< Operace (reduce)
+	long long iAcc;							///< Akumulátor úseku (reduce)
+	size_t iMatched;						///< Počet elementů splňujících predikát (count_if, partition)
+};
+
+static void* queue_count_worker(void* aArg)
+{
+	struct TQueueJob* job = aArg;
+	struct TQueueNode* node = job->iStart;
+	for (size_t i = 0; i < job->iLength; i++, node = node->iNext) {
+		const struct TQueueIterator iter = { .iQueue = job->iQueue, .iActual = node };
+		if (job->iPredicate(&iter)) {
+			job->iMatched++;
+		}
+	}
+	return NULL;
+}
+
+static void* queue_transform_worker(void* aArg)
+{
+	struct TQueueJob* job = aArg;
+	struct TQueueNode* node = job->iStart;
+	for (size_t i = 0; i < job->iLength; i++, node = node->iNext) {
+		node->iValue = job->iTransform(node->iValue);
+	}
+	return NULL;
+}
+
+static void* queue_reduce_worker(void* aArg)
+{
+	struct TQueueJob* job = aArg;
+	struct TQueueNode* node = job->iStart;
+	for (size_t i = 0; i < job->iLength; i++, node = node->iNext) {
+		job->iAcc = job->iReduce(job->iAcc, node->iValue);
+	}
+	return NULL;
+}
+
+static void* queue_partition_worker(void* aArg)
+{
+	// Rozdělení úseku (stejný postup jako queue_partition), iMatched je počet vyhovujících elementů na začátku úseku.
+	struct TQueueJob* job = aArg;
+	struct TQueueNode* first = job->iStart;
+	struct TQueueNode* node = job->iStart;
+	for (size_t i = 0; i < job->iLength; i++, node = node->iNext) {
+		const struct TQueueIterator iter = { .iQueue = job->iQueue, .iActual = node };
+		if (job->iPredicate(&iter)) {
+			const TQueueElement value = first->iValue;
+			first->iValue = node->iValue;
+			node->iValue = value;
+			first = first->iNext;
+			job->iMatched++;
+		}
+	}
+	return NULL;
+}
+
+// Rozdělí frontu na úseky (jedním průchodem seznamem), vrací počet úseků.
+static unsigned queue_split(const struct TQueue* aQueue, unsigned aThreads, struct TQueueJob* aJobs)
+{
+	if (aThreads == 0) {
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		aThreads = cpus > 0 ? (unsigned)cpus : 1;
+	}
+	if (aThreads > QUEUE_MAX_THREADS) {
+		aThreads = QUEUE_MAX_THREADS;
+	}
+	const size_t count = queue_size(aQueue);
+	if (aThreads > count / QUEUE_PARALLEL_MIN) {
+		aThreads = count / QUEUE_PARALLEL_MIN > 0 ? (unsigned)(count / QUEUE_PARALLEL_MIN) : 1;
+	}
+	struct TQueueNode* node = aQueue->iFront;
+	size_t begin = 0;
+	for (unsigned i = 0; i < aThreads; i++) {
+		const size_t end = count * (i + 1) / aThreads;
+		aJobs[i] = (struct TQueueJob){ .iQueue = aQueue, .iStart = node, .iLength = end - begin };
+		for (size_t j = begin; j < end && i + 1 < aThreads; j++) {
+			node = node->iNext;
+		}
+		begin = end;
+	}
+	return aThreads;
+}
+
+// Sdílená skupina pracovních vláken, vlákna vznikají při prvním použití a běží až do konce procesu.
+// Pracovní vlákno s indexem i zpracuje úsek i (úsek 0 zpracuje volající vlákno).
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;	// Drží volající po celou dobu použití skupiny
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;	// Chrání proměnné níže
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;	// Nová generace úseků
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;	// Poslední úsek generace je hotov
+static unsigned pool_threads;					// Počet spuštěných pracovních vláken
+static unsigned long pool_generation;			// Pořadové číslo volání, začíná od 1
+static struct TQueueJob* pool_jobs;
+static unsigned pool_count;						// Úseky s indexem menším než pool_count zpracují pracovní vlákna
+static unsigned pool_pending;					// Úseky generace, které ještě nejsou hotové
+static void* (*pool_worker)(void*);
+
+static void* queue_pool_thread(void* aArg)
+{
+	// Vlákno vzniká vždy až pro generaci, ve které je potřeba, první generaci tedy nemůže zmeškat.
+	const unsigned index = (unsigned)(uintptr_t)aArg;
+	unsigned long seen = 0;
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (pool_generation == seen) {
+			pthread_cond_wait(&pool_work, &pool_lock);
+		}
+		seen = pool_generation;
+		if (index < pool_count) {
+			struct TQueueJob* job = &pool_jobs[index];
+			void* (*worker)(void*) = pool_worker;
+			pthread_mutex_unlock(&pool_lock);
+			worker(job);
+			pthread_mutex_lock(&pool_lock);
+			if (--pool_pending == 0) {
+				pthread_cond_signal(&pool_done);
+			}
+		}
+	}
+	return NULL;
+}
+
+// Spustí aWorker pro každý úsek pomocí skupiny vláken, volající musí držet pool_mutex.
+static void queue_pool_run(struct TQueueJob* aJobs, unsigned aCount, void* (*aWorker)(void*))
+{
+	pthread_mutex_lock(&pool_lock);
+	if (pool_threads + 1 < aCount) {
+		// Signály se doručují vláknům programu, ne pracovním vláknům skupiny
+		sigset_t all, old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		while (pool_threads + 1 < aCount) {
+			pthread_t thread;
+			if (pthread_create(&thread, &attr, queue_pool_thread, (void*)(uintptr_t)(pool_threads + 1)) != 0) {
+				break;
+			}
+			pool_threads++;
+		}
+		pthread_attr_destroy(&attr);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+	const unsigned pooled = pool_threads + 1 < aCount ? pool_threads + 1 : aCount;
+	pool_jobs = aJobs;
+	pool_count = pooled;
+	pool_worker = aWorker;
+	pool_pending = pooled - 1;
+	pool_generation++;
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_lock);
+
+	// Úseky, pro které se nepodařilo spustit vlákno, a první úsek zpracuje volající vlákno
+	for (unsigned i = pooled; i < aCount; i++) {
+		aWorker(&aJobs[i]);
+	}
+	aWorker(&aJobs[0]);
+
+	pthread_mutex_lock(&pool_lock);
+	while (pool_pending > 0) {
+		pthread_cond_wait(&pool_done, &pool_lock);
+	}
+	pool_jobs = NULL;
+	pool_count = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// Spustí aWorker pro každý úsek, první úsek zpracuje volající vlákno.
+// Souběžné nebo vnořené volání (z předané funkce) skupinu nečeká, ale spustí si vlastní vlákna.
+static void queue_run(struct TQueueJob* aJobs, unsigned aCount, void* (*aWorker)(void*))
+{
+	if (aCount > 1 && pthread_mutex_trylock(&pool_mutex) == 0) {
+		queue_pool_run(aJobs, aCount, aWorker);
+		pthread_mutex_unlock(&pool_mutex);
+		return;
+	}
+	pthread_t threads[QUEUE_MAX_THREADS];
+	bool started[QUEUE_MAX_THREADS] = { false };
+	for (unsigned i = 1; i < aCount; i++) {
+		started[i] = pthread_create(&threads[i], NULL, aWorker, &aJobs[i]) == 0;
+		if (!started[i]) {
+			aWorker(&aJobs[i]);
+		}
+	}
+	aWorker(&aJobs[0]);
+	for (unsigned i = 1; i < aCount; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+}
+
+size_t queue_count_if_parallel(const struct TQueue* aQueue, bool(*aPredicate)(const struct TQueueIterator* aIter), unsigned aThreads)
+{
+	if (queue_is_empty(aQueue) || !aPredicate) {
+		return 0;
+	}
+	struct TQueueJob jobs[QUEUE_MAX_THREADS];
+	const unsigned count = queue_split(aQueue, aThreads, jobs);
+	size_t matched = 0;
+	for (unsigned i = 0; i < count; i++) {
+		jobs[i].iPredicate = aPredicate;
+	}
+	queue_run(jobs, count, queue_count_worker);
+	for (unsigned i = 0; i < count; i++) {
+		matched += jobs[i].iMatched;
+	}
+	return matched;
+}
+
+void queue_transform_parallel(struct TQueue* aQueue, TQueueElement(*aOperation)(TQueueElement aValue), unsigned aThreads)
+{
+	if (queue_is_empty(aQueue) || !aOperation) {
+		return;
+	}
+	struct TQueueJob jobs[QUEUE_MAX_THREADS];
+	const unsigned count = queue_split(aQueue, aThreads, jobs);
+	for (unsigned i = 0; i < count; i++) {
+		jobs[i].iTransform = aOperation;
+	}
+	queue_run(jobs, count, queue_transform_worker);
+}
+
+long long queue_reduce_parallel(const struct TQueue* aQueue, long long aInit, long long(*aOperation)(long long aAcc, TQueueElement aValue), long long(*aCombine)(long long aLeft, long long aRight), unsigned aThreads)
+{
+	if (queue_is_empty(aQueue) || !aOperation || !aCombine) {
+		return aInit;
+	}
+	struct TQueueJob jobs[QUEUE_MAX_THREADS];
+	const unsigned count = queue_split(aQueue, aThreads, jobs);
+	for (unsigned i = 0; i < count; i++) {
+		jobs[i].iReduce = aOperation;
+		jobs[i].iAcc = aInit;
+	}
+	queue_run(jobs, count, queue_reduce_worker);
+	long long result = jobs[0].iAcc;
+	for (unsigned i = 1; i < count; i++) {
+		result = aCombine(result, jobs[i].iAcc);
+	}
+	return result;
+}
+
+struct TQueueIterator queue_partition_parallel(struct TQueue* aQueue, bool(*aPredicate)(const struct TQueueIterator* aIter), unsigned aThreads)
+{
+	// Po rozdělení úseků leží na pozicích [0, total) všech úseků vyhovující elementy jen na začátcích úseků.
+	// Nevyhovující elementy z přední části [0, total) se prohodí s vyhovujícími elementy ze zadní části [total, n),
+	// obou je stejný počet a predikát již není potřeba volat znovu.
+	if (queue_is_empty(aQueue) || !aPredicate) {
+		return queue_iterator_begin(NULL);
+	}
+	struct TQueueJob jobs[QUEUE_MAX_THREADS];
+	const unsigned count = queue_split(aQueue, aThreads, jobs);
+	for (unsigned i = 0; i < count; i++) {
+		jobs[i].iPredicate = aPredicate;
+	}
+	queue_run(jobs, count, queue_partition_worker);
+
+	size_t total = 0;
+	for (unsigned i = 0; i < count; i++) {
+		total += jobs[i].iMatched;
+	}
+
+	// Levý kurzor prochází pozice [0, total), pravý kurzor pozice [total, n), oba si pamatují úsek a pozici v něm
+	struct TQueueNode* left = aQueue->iFront;
+	unsigned left_job = 0;
+	size_t left_off = 0;
+	struct TQueueNode* right = aQueue->iFront;
+	unsigned right_job = 0;
+	size_t right_off = 0;
+	for (size_t pos = 0; pos < total; pos++) {
+		right = right->iNext;
+		if (++right_off == jobs[right_job].iLength) {
+			right_job++;
+			right_off = 0;
+		}
+	}
+	struct TQueueIterator result = { .iQueue = right ? aQueue : NULL, .iActual = right };
+
+	for (size_t pos = 0; pos < total; pos++) {
+		if (left_off >= jobs[left_job].iMatched) {
+			// Nevyhovující element v přední části, najdi vyhovující element v zadní části
+			while (right_off >= jobs[right_job].iMatched) {
+				right = right->iNext;
+				if (++right_off == jobs[right_job].iLength) {
+					right_job++;
+					right_off = 0;
+				}
+			}
+			const TQueueElement value = left->iValue;
+			left->iValue = right->iValue;
+			right->iValue = value;
+			right = right->iNext;
+			if (++right_off == jobs[right_job].iLength) {
+				right_job++;
+				right_off = 0;
+			}
+		}
+		left = left->iNext;
+		if (++left_off == jobs[left_job].iLength) {
+			left_job++;
+			left_off = 0;
+		}
+	}
+	return result;
+}
@@ -9,21 +9,50 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 
 /** \defgroup TQueue 1. Fronta
  *  \brief Definice datového typu Queue a jeho funkcí (realizace fronty pomocí lineárního jednosměrně vázaného seznamu)
  *  \{
  */
 
-typedef char TQueueElement;					///< Definice typu QueueElement (datový typ elementů fronty)
+/** \brief Definice typu QueueElement (datový typ elementů fronty)
+ *  \details Element nese kromě vlastních dat také pořadové číslo vzorku a časové razítko (\c CLOCK_MONOTONIC) okamžiku přečtení dat z UART, takže je možné sledovat stáří vzorku až do jeho aplikace v mixeru.
+ */
+typedef struct
+	{
+	char iData;								///< Data elementu (bajt přijatý z UART, resp. hodnota hlasitosti)
+	unsigned int iSeq;						///< Pořadové číslo vzorku (přiřazeno při rámcování, do té doby 0)
+	struct timespec iStamp;					///< Časové razítko (\c CLOCK_MONOTONIC) okamžiku přečtení dat z UART
+	} TQueueElement;
+
+/** \brief Definice politiky chování omezené fronty při jejím zaplnění
+ *  \details Politika určuje, co provede funkce queue_push(), pokud je omezená fronta plná.
+ */
+enum TQueueOverflowPolicy
+	{
+	QUEUE_OVERFLOW_BLOCK,					///< Element není vložen a queue_push() vrací \c false, volající musí počkat na uvolnění místa (zpětný tlak), nejde o zahození
+	QUEUE_OVERFLOW_DROP_OLDEST,				///< Element z čela fronty je zahozen a nový element je vložen na konec fronty
+	QUEUE_OVERFLOW_DROP_NEWEST,				///< Nový element je zahozen a queue_push() vrací \c false
+	QUEUE_OVERFLOW_COALESCE					///< Nový element přepíše element na konci fronty (platí vždy jen nejnovější hodnota)
+	};
 
 /** \brief Definice typu Queue
  *  \details Typ Queue obsahuje ukazatele na dynamicky alokované proměnné typu QueueNode, které představují uzly s hodnotami elementů uspořádanými do lineárního jednosměrně vázaného seznamu. Fronta umožňuje pracovat se svými elementy pomocí definovaného API.
+ *  Fronta může mít omezenou kapacitu, po jejímž dosažení se uplatní zvolená politika TQueueOverflowPolicy.
+ *  Uzly lze předalokovat funkcí queue_reserve(), vkládání a odebírání pak v ustáleném stavu nealokuje ani neuvolňuje paměť.
  */
 struct TQueue
 	{
 	struct TQueueNode *iFront;				///< PIMPL ukazatel na první uzel lineárního jednosměrně vázaného seznamu realizujícího frontu
 	struct TQueueNode *iBack;				///< PIMPL ukazatel na poslední uzel lineárního jednosměrně vázaného seznamu realizujícího frontu
+	size_t iCount;							///< Aktuální počet elementů ve frontě
+	size_t iCapacity;						///< Maximální počet elementů ve frontě (0 pro neomezenou frontu)
+	enum TQueueOverflowPolicy iPolicy;		///< Politika uplatněná při vkládání do plné fronty
+	size_t iDropped;						///< Počet elementů zahozených (nebo přepsaných) kvůli zaplnění fronty
+	struct TQueueNode *iFree;				///< PIMPL ukazatel na první uzel seznamu předalokovaných volných uzlů
+	size_t iFreeCount;						///< Počet volných uzlů v seznamu iFree
+	size_t iReserved;						///< Počet uzlů, které si fronta ponechává (obsazené i volné) místo jejich dealokace
 	};
 
 /** \brief Inicializace prázdné fronty
@@ -32,6 +61,41 @@ struct TQueue
  */
 void queue_init(struct TQueue *aQueue);
 
+/** \brief Inicializace prázdné fronty s omezenou kapacitou
+ *  \details Inicializuje složky struktury tak, aby byl výsledkem prázdná fronta, která pojme nejvýše \p aCapacity elementů. Při vkládání do plné fronty se uplatní politika \p aPolicy.
+ *  \param[in,out] aQueue Ukazatel na místo v paměti určené pro inicializaci fronty
+ *  \param[in] aCapacity Maximální počet elementů ve frontě (0 pro neomezenou frontu)
+ *  \param[in] aPolicy Politika uplatněná při vkládání do plné fronty
+ */
+void queue_init_bounded(struct TQueue *aQueue, size_t aCapacity, enum TQueueOverflowPolicy aPolicy);
+
+/** \brief Předalokace uzlů fronty
+ *  \details Zajistí, aby fronta vlastnila alespoň \p aCount uzlů (obsazených i volných). Chybějící uzly alokuje do seznamu volných uzlů, přebývající volné uzly uvolní.
+ *  Funkce queue_push() pak nejprve použije volný uzel a funkce queue_pop() uvolněný uzel vrací do seznamu volných uzlů, dokud fronta vlastní nejvýše \p aCount uzlů.
+ *  Pro omezenou frontu s \p aCount rovným její kapacitě tak vkládání ani odebírání nikdy nealokuje paměť.
+ *  \param[in,out] aQueue Ukazatel na existující frontu
+ *  \param[in] aCount Počet uzlů, které si fronta ponechává (0 pro dealokaci každého odebraného uzlu)
+ *  \return \c true pokud se alokace všech chybějících uzlů povedla
+ */
+bool queue_reserve(struct TQueue *aQueue, size_t aCount);
+
+/** \brief Změna kapacity fronty
+ *  \details Nastaví novou kapacitu existující fronty. Pokud fronta obsahuje více elementů, než nová kapacita dovoluje, rozhodne o přebývajících elementech politika fronty:
+ *  QUEUE_OVERFLOW_BLOCK je ponechá (queue_push() selže, dokud jejich počet neklesne pod kapacitu), QUEUE_OVERFLOW_DROP_OLDEST a QUEUE_OVERFLOW_COALESCE zahodí nejstarší elementy a QUEUE_OVERFLOW_DROP_NEWEST nejnovější elementy.
+ *  Zahozené elementy jsou započítány do queue_dropped(). Předalokované uzly funkce nemění, viz queue_reserve().
+ *  \param[in,out] aQueue Ukazatel na existující frontu
+ *  \param[in] aCapacity Maximální počet elementů ve frontě (0 pro neomezenou frontu)
+ *  \return Počet elementů zahozených při zmenšení fronty
+ */
+size_t queue_set_capacity(struct TQueue *aQueue, size_t aCapacity);
+
+/** \brief Změna politiky fronty
+ *  \details Nastaví politiku uplatněnou při vkládání do plné fronty. Elementy fronty ani počitadlo zahozených elementů se nemění.
+ *  \param[in,out] aQueue Ukazatel na existující frontu
+ *  \param[in] aPolicy Politika uplatněná při vkládání do plné fronty
+ */
+void queue_set_policy(struct TQueue *aQueue, enum TQueueOverflowPolicy aPolicy);
+
 /** \brief Zjištění, zda je fronta prázdná
  *  \details Funkce (predikát) vracející \c bool hodnotu reprezentující test, zda je fronta prázdná.
  *  \param[in] aQueue Ukazatel na existující frontu
@@ -39,6 +103,38 @@ void queue_init(struct TQueue *aQueue);
  */
 bool queue_is_empty(const struct TQueue *aQueue);
 
+/** \brief Zjištění, zda je fronta plná
+ *  \details Funkce (predikát) vracející \c bool hodnotu reprezentující test, zda omezená fronta dosáhla své kapacity. Neomezená fronta není nikdy plná.
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \return \c true pokud je fronta plná
+ */
+bool queue_is_full(const struct TQueue *aQueue);
+
+/** \brief Zjištění počtu elementů fronty
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \return Aktuální počet elementů ve frontě
+ */
+size_t queue_size(const struct TQueue *aQueue);
+
+/** \brief Zjištění kapacity fronty
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \return Maximální počet elementů ve frontě, nebo 0 pro neomezenou frontu
+ */
+size_t queue_capacity(const struct TQueue *aQueue);
+
+/** \brief Zjištění počtu zahozených elementů
+ *  \details Vrací počet elementů, které byly kvůli zaplnění fronty zahozeny (politiky QUEUE_OVERFLOW_DROP_OLDEST a QUEUE_OVERFLOW_DROP_NEWEST) nebo přepsány (politika QUEUE_OVERFLOW_COALESCE).
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \return Počet zahozených elementů od inicializace fronty
+ */
+size_t queue_dropped(const struct TQueue *aQueue);
+
+/** \brief Zjištění politiky fronty
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \return Politika uplatněná při vkládání do plné fronty
+ */
+enum TQueueOverflowPolicy queue_policy(const struct TQueue *aQueue);
+
 /** \brief Získání hodnoty elementu z čela fronty
  *  \details Přečte hodnotu elementu z čela fronty.
  *  \param[in] aQueue Ukazatel na existující frontu
@@ -56,10 +152,10 @@ bool /* TQueueIterator */ queue_front(const struct TQueue *aQueue, TQueueElement
 bool /* TQueueIterator */ queue_back(const struct TQueue *aQueue, TQueueElement *aValue);
 
 /** \brief Vložení elementu do fronty
- *  \details Vkládá hodnotu elementu na konec fronty.
+ *  \details Vkládá hodnotu elementu na konec fronty. Je-li omezená fronta plná, uplatní se její politika TQueueOverflowPolicy.
  *  \param[in,out] aQueue Ukazatel na existující frontu určenou pro vložení elementu
  *  \param[in] aValue Hodnota elementu vkládaná do fronty
- *  \return \c true pokud byla hodnota do fronty úspěšně vložena
+ *  \return \c true pokud byla hodnota do fronty úspěšně vložena (u politiky QUEUE_OVERFLOW_COALESCE i tehdy, pokud přepsala element na konci fronty)
  */
 bool queue_push(struct TQueue *aQueue, TQueueElement aValue);
 
@@ -71,7 +167,7 @@ bool queue_push(struct TQueue *aQueue, TQueueElement aValue);
 bool queue_pop(struct TQueue *aQueue);
 
 /** \brief Deinicializace fronty
- *  \details Deinicializuje frontu, nastaví počet elementů fronty na hodnotu 0.
+ *  \details Deinicializuje frontu, nastaví počet elementů fronty a počet zahozených elementů na hodnotu 0. Uvolní i předalokované volné uzly a zruší rezervaci. Kapacita a politika fronty zůstávají zachovány.
  *  \param[in,out] aQueue Ukazatel na existující frontu
  */
 void queue_destroy(struct TQueue *aQueue);
@@ -172,6 +268,122 @@ static inline struct TQueueIterator queue_find_if_not(struct TQueueIterator aIte
 	return aIter;
 	}
 
+/** \brief Zjištění počtu elementů fronty splňujících zadaný predikát
+ *  \details Spočítá elementy fronty splňující zadaný predikát \p aPredicate v rozsahu od elementu určeného iterátorem \p aIter až do konce fronty.
+ *  Funkce je \c static \c inline, při volání se známou funkcí \p aPredicate ji tak překladač může vložit přímo do smyčky.
+ *  \param[in] aIter Ukazatel na existující iterátor, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aPredicate Ukazatel na predikátovou funkci (funkci vracející \c bool a mající jeden parametr typu ukazatel na iterátor)
+ *  \return Počet elementů splňujících zadaný predikát \p aPredicate
+ */
+static inline size_t queue_count_if(struct TQueueIterator aIter, bool(*aPredicate)(const struct TQueueIterator *aIter))
+	{
+	size_t count = 0;
+	for(bool valid = queue_iterator_is_valid(&aIter); valid; valid = queue_iterator_to_next(&aIter))
+		if(aPredicate(&aIter))
+			count++;
+	return count;
+	}
+
+/** \brief Přepsání každého elementu fronty výsledkem zvolené funkce
+ *  \details Nahradí každý element fronty v rozsahu od pozice určené iterátorem \p aIter až do konce fronty hodnotou, kterou pro něj vrátí funkce \p aOperation.
+ *  \param[in] aIter Ukazatel na existující iterátor, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aOperation Ukazatel na funkci vracející novou hodnotu elementu a mající jeden parametr typu TQueueElement (původní hodnota elementu)
+ */
+static inline void queue_transform(struct TQueueIterator aIter, TQueueElement(*aOperation)(TQueueElement aValue))
+	{
+	for(bool valid = queue_iterator_is_valid(&aIter); valid; valid = queue_iterator_to_next(&aIter))
+		queue_iterator_set_value(&aIter, aOperation(queue_iterator_value(&aIter)));
+	}
+
+/** \brief Redukce elementů fronty na jednu hodnotu
+ *  \details Postupně zkombinuje počáteční hodnotu \p aInit se všemi elementy fronty v rozsahu od pozice určené iterátorem \p aIter až do konce fronty (např. součet, minimum nebo maximum vzorků).
+ *  \param[in] aIter Ukazatel na existující iterátor, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aInit Počáteční hodnota akumulátoru
+ *  \param[in] aOperation Ukazatel na funkci vracející novou hodnotu akumulátoru a mající dva parametry (dosavadní hodnota akumulátoru a hodnota elementu)
+ *  \return Výsledná hodnota akumulátoru, nebo \p aInit pro prázdný rozsah
+ */
+static inline long long queue_reduce(struct TQueueIterator aIter, long long aInit, long long(*aOperation)(long long aAcc, TQueueElement aValue))
+	{
+	for(bool valid = queue_iterator_is_valid(&aIter); valid; valid = queue_iterator_to_next(&aIter))
+		aInit = aOperation(aInit, queue_iterator_value(&aIter));
+	return aInit;
+	}
+
+/** \brief Rozdělení elementů fronty podle zadaného predikátu
+ *  \details Přeuspořádá elementy fronty v rozsahu od pozice určené iterátorem \p aIter až do konce fronty tak, že elementy splňující predikát \p aPredicate předcházejí elementům, které jej nesplňují.
+ *  Uzly fronty zůstávají na místě, elementy se pouze prohazují pomocí iterátorů. Původní pořadí elementů v obou částech není zachováno.
+ *  \param[in] aIter Ukazatel na existující iterátor, jenž je předem asociovaný se zvolenou frontou a který tak definuje počáteční element pro zvolenou operaci
+ *  \param[in] aPredicate Ukazatel na predikátovou funkci (funkci vracející \c bool a mající jeden parametr typu ukazatel na iterátor)
+ *  \return Hodnota iterátoru ukazujícího na první element nesplňující predikát \p aPredicate, nebo neplatný iterátor, pokud jej splňují všechny elementy.
+ */
+static inline struct TQueueIterator queue_partition(struct TQueueIterator aIter, bool(*aPredicate)(const struct TQueueIterator *aIter))
+	{
+	aIter = queue_find_if_not(aIter, aPredicate);
+	if(!queue_iterator_is_valid(&aIter))
+		return aIter;
+	// aIter ukazuje vždy na první element nesplňující predikát, každý další vyhovující element se s ním prohodí
+	struct TQueueIterator next = aIter;
+	while(queue_iterator_to_next(&next))
+		if(aPredicate(&next))
+			{
+			const TQueueElement value = queue_iterator_value(&aIter);
+			queue_iterator_set_value(&aIter, queue_iterator_value(&next));
+			queue_iterator_set_value(&next, value);
+			queue_iterator_to_next(&aIter);
+			}
+	return aIter;
+	}
+
 /** \} IteratorAlgoritms */
 
+/** \defgroup ParallelAlgorithms 5. Paralelní algoritmy nad frontou
+ *  \brief Varianty algoritmů zpracovávající celou frontu po úsecích ve více vláknech
+ *  \details Fronta je rozdělena na souvislé úseky přibližně stejné délky, každý úsek zpracuje jedno vlákno (první z nich volající vlákno).
+ *  Vlákna se nevytvářejí při každém volání, ale při prvním použití vznikne sdílená skupina pracovních vláken, která se dále používá. Souběžné volání z jiného vlákna si vytvoří vlastní vlákna.
+ *  Začátky úseků se hledají jedním průchodem seznamem, paralelní varianta se proto vyplatí u velkých front a u funkcí, jejichž výpočet je dražší než přesun na další uzel.
+ *  Fronty menší než \c QUEUE_PARALLEL_MIN elementů na vlákno se zpracují sekvenčně. Předané funkce musí být bezpečné pro souběžné volání a fronta se během zpracování nesmí měnit.
+ *  \{
+ */
+
+#define QUEUE_PARALLEL_MIN 65536		///< Nejmenší počet elementů připadajících na jedno vlákno
+#define QUEUE_MAX_THREADS 64			///< Nejvyšší počet vláken jednoho volání
+
+/** \brief Paralelní varianta funkce queue_count_if() pro celou frontu
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \param[in] aPredicate Ukazatel na predikátovou funkci (funkci vracející \c bool a mající jeden parametr typu ukazatel na iterátor)
+ *  \param[in] aThreads Nejvyšší počet vláken (0 pro počet dostupných procesorů)
+ *  \return Počet elementů splňujících zadaný predikát \p aPredicate
+ */
+size_t queue_count_if_parallel(const struct TQueue *aQueue, bool(*aPredicate)(const struct TQueueIterator *aIter), unsigned aThreads);
+
+/** \brief Paralelní varianta funkce queue_transform() pro celou frontu
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \param[in] aOperation Ukazatel na funkci vracející novou hodnotu elementu a mající jeden parametr typu TQueueElement (původní hodnota elementu)
+ *  \param[in] aThreads Nejvyšší počet vláken (0 pro počet dostupných procesorů)
+ */
+void queue_transform_parallel(struct TQueue *aQueue, TQueueElement(*aOperation)(TQueueElement aValue), unsigned aThreads);
+
+/** \brief Paralelní varianta funkce queue_reduce() pro celou frontu
+ *  \details Každý úsek se redukuje zvlášť s počáteční hodnotou \p aInit, dílčí výsledky se pak v pořadí úseků spojí funkcí \p aCombine.
+ *  Hodnota \p aInit proto musí být neutrálním prvkem operace a operace musí být asociativní (součet, minimum, maximum), jinak se výsledek liší od sekvenční varianty.
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \param[in] aInit Počáteční hodnota akumulátoru (neutrální prvek operace)
+ *  \param[in] aOperation Ukazatel na funkci vracející novou hodnotu akumulátoru a mající dva parametry (dosavadní hodnota akumulátoru a hodnota elementu)
+ *  \param[in] aCombine Ukazatel na funkci spojující dva dílčí výsledky
+ *  \param[in] aThreads Nejvyšší počet vláken (0 pro počet dostupných procesorů)
+ *  \return Výsledná hodnota akumulátoru, nebo \p aInit pro prázdnou frontu
+ */
+long long queue_reduce_parallel(const struct TQueue *aQueue, long long aInit, long long(*aOperation)(long long aAcc, TQueueElement aValue), long long(*aCombine)(long long aLeft, long long aRight), unsigned aThreads);
+
+/** \brief Paralelní varianta funkce queue_partition() pro celou frontu
+ *  \details Každý úsek se nejprve rozdělí samostatně, poté se elementy nesplňující predikát z přední části fronty prohodí s vyhovujícími elementy ze zadní části. Predikát se pro každý element volá právě jednou.
+ *  \param[in] aQueue Ukazatel na existující frontu
+ *  \param[in] aPredicate Ukazatel na predikátovou funkci (funkci vracející \c bool a mající jeden parametr typu ukazatel na iterátor)
+ *  \param[in] aThreads Nejvyšší počet vláken (0 pro počet dostupných procesorů)
+ *  \return Hodnota iterátoru ukazujícího na první element nesplňující predikát \p aPredicate, nebo neplatný iterátor, pokud jej splňují všechny elementy.
+ */
+struct TQueueIterator queue_partition_parallel(struct TQueue *aQueue, bool(*aPredicate)(const struct TQueueIterator *aIter), unsigned aThreads);
+
+/** \} ParallelAlgorithms */
+
 #endif /* TQUEUE_H */
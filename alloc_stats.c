@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include "alloc_stats.h"
+#include <malloc.h>
+#include <stdatomic.h>
+
+static atomic_ulong stat_allocs;
+static atomic_ulong stat_frees;
+static atomic_size_t stat_live;
+static atomic_size_t stat_peak;
+static atomic_ulong stat_steady;
+static atomic_int steady = 0; // Warm-up is over
+static _Atomic(alloc_hook) steady_hook = nullptr;
+
+#ifdef SPC_ALLOC_STATS
+
+// The real allocator, provided by the linker for --wrap
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+// Account for a returned block, size is what the caller asked for
+static void alloc_note(void* ptr, const size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&stat_allocs, 1, memory_order_relaxed);
+    const size_t usable = malloc_usable_size(ptr);
+    const size_t live = atomic_fetch_add_explicit(&stat_live, usable, memory_order_relaxed) + usable;
+    size_t peak = atomic_load_explicit(&stat_peak, memory_order_relaxed);
+    while (live > peak && !atomic_compare_exchange_weak_explicit(&stat_peak, &peak, live, memory_order_relaxed,
+                                                                 memory_order_relaxed))
+    {
+    }
+    if (atomic_load_explicit(&steady, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&stat_steady, 1, memory_order_relaxed);
+        const alloc_hook hook = atomic_load_explicit(&steady_hook, memory_order_acquire);
+        if (hook != nullptr)
+        {
+            hook(size);
+        }
+    }
+}
+
+// Account for a block about to be released
+static void alloc_forget(void* ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    atomic_fetch_add_explicit(&stat_frees, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&stat_live, malloc_usable_size(ptr), memory_order_relaxed);
+}
+
+void* __wrap_malloc(const size_t size)
+{
+    void* ptr = __real_malloc(size);
+    alloc_note(ptr, size);
+    return ptr;
+}
+
+void* __wrap_calloc(const size_t count, const size_t size)
+{
+    void* ptr = __real_calloc(count, size);
+    alloc_note(ptr, count * size);
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, const size_t size)
+{
+    // The old block is gone once realloc succeeds, a failed realloc keeps it
+    const size_t old_size = ptr != nullptr ? malloc_usable_size(ptr) : 0;
+    void* resized = __real_realloc(ptr, size);
+    if (resized != nullptr && ptr != nullptr)
+    {
+        atomic_fetch_add_explicit(&stat_frees, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&stat_live, old_size, memory_order_relaxed);
+    }
+    alloc_note(resized, size);
+    return resized;
+}
+
+void __wrap_free(void* ptr)
+{
+    alloc_forget(ptr);
+    __real_free(ptr);
+}
+
+#endif // SPC_ALLOC_STATS
+
+int alloc_stats_available(void)
+{
+#ifdef SPC_ALLOC_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void alloc_set_hook(const alloc_hook hook)
+{
+    atomic_store_explicit(&steady_hook, hook, memory_order_release);
+}
+
+void alloc_steady_begin(void)
+{
+    atomic_store(&steady, 1);
+}
+
+void alloc_steady_end(void)
+{
+    atomic_store(&steady, 0);
+}
+
+struct alloc_stats alloc_get_stats(void)
+{
+    return (struct alloc_stats){
+        .allocs = atomic_load(&stat_allocs),
+        .frees = atomic_load(&stat_frees),
+        .live_bytes = atomic_load(&stat_live),
+        .peak_bytes = atomic_load(&stat_peak),
+        .steady_allocs = atomic_load(&stat_steady),
+    };
+}
@@ -0,0 +1,41 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stddef.h>
+
+// Heap accounting.
+// Built with SPC_ALLOC_STATS, the linker routes malloc, calloc, realloc and free called by the program's own code
+// through counting wrappers (-Wl,--wrap). Allocations made inside libc (stdio, popen, system) are not seen, so the
+// steady state only covers the program-level allocations of the per-sample path, not the amixer processes the
+// mixer thread starts.
+// Once alloc_steady_begin() marks the end of warm-up, every allocation is a steady-state allocation: it is
+// counted separately and passed to the hook, which can report it or abort.
+
+struct alloc_stats
+{
+    unsigned long allocs; // Calls that returned memory
+    unsigned long frees; // Calls that released memory
+    size_t live_bytes; // Usable bytes currently allocated
+    size_t peak_bytes; // Highest live_bytes seen
+    unsigned long steady_allocs; // Allocations made in the steady state
+};
+
+// Called with the requested size for each steady-state allocation, from the allocating thread
+typedef void (*alloc_hook)(size_t size);
+
+// 1 when the wrappers are linked in and the counters are meaningful
+int alloc_stats_available(void);
+
+// Hook for steady-state allocations, nullptr to only count them
+void alloc_set_hook(alloc_hook hook);
+
+// End of warm-up, from now on the hot path is expected not to allocate
+void alloc_steady_begin(void);
+
+// Leave the steady state, e.g. while the configuration is reloaded
+void alloc_steady_end(void);
+
+// Snapshot of the counters
+struct alloc_stats alloc_get_stats(void);
+
+#endif // ALLOC_STATS_H
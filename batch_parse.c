@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include "batch_parse.h"
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+#define BATCH_GROUP 8 // Samples converted together, one AVX2 register of packed digits
+#define BATCH_MAX_THREADS 64
+
+enum batch_isa
+{
+    BATCH_ISA_UNKNOWN,
+    BATCH_ISA_SCALAR,
+    BATCH_ISA_SSE2,
+    BATCH_ISA_AVX2,
+};
+
+static enum batch_isa batch_isa = BATCH_ISA_UNKNOWN; // Chosen on first use
+static pthread_once_t batch_isa_once = PTHREAD_ONCE_INIT;
+
+static void batch_isa_detect(void)
+{
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        batch_isa = BATCH_ISA_AVX2;
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        batch_isa = BATCH_ISA_SSE2;
+        return;
+    }
+#endif
+    batch_isa = BATCH_ISA_SCALAR;
+}
+
+int batch_parse_set_isa(const char* isa)
+{
+    pthread_once(&batch_isa_once, batch_isa_detect);
+    enum batch_isa chosen = BATCH_ISA_SCALAR;
+    if (strcmp(isa, "avx2") == 0 || strcmp(isa, "sse2") == 0)
+    {
+#ifdef BATCH_X86
+        chosen = isa[0] == 'a' ? BATCH_ISA_AVX2 : BATCH_ISA_SSE2;
+        if (!(chosen == BATCH_ISA_AVX2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("sse2")))
+        {
+            return 1;
+        }
+#else
+        return 1;
+#endif
+    }
+    else if (strcmp(isa, "scalar") != 0)
+    {
+        return 1;
+    }
+    batch_isa = chosen;
+    return 0;
+}
+
+const char* batch_parse_isa(void)
+{
+    pthread_once(&batch_isa_once, batch_isa_detect);
+    switch (batch_isa)
+    {
+    case BATCH_ISA_AVX2:
+        return "avx2";
+    case BATCH_ISA_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+unsigned int batch_volume(const unsigned int adc)
+{
+    if (adc > 1020)
+    {
+        return 100;
+    }
+    // 100 * adc / 1024 without overflowing 16 bits
+    return (adc * 25) >> 8;
+}
+
+// Pack the sample ending before end into four digit bytes, right aligned and padded with '0'.
+// Returns its length, 0 for an empty or too long sample, whose packed value is then all '0'
+static size_t batch_pack(const char* buf, const char* start, const char* end, uint32_t* packed)
+{
+    const size_t len = (size_t)(end - start);
+    if (len == 0 || len > BATCH_MAX_DIGITS)
+    {
+        *packed = 0x30303030u;
+        return 0;
+    }
+    if (end - buf >= 4)
+    {
+        // Load the four bytes before the delimiter and replace the ones of the previous sample with '0'
+        uint32_t word;
+        memcpy(&word, end - 4, sizeof(word));
+        const uint32_t keep = 0xffffffffu << ((4 - len) * 8);
+        *packed = (word & keep) | (0x30303030u & ~keep);
+        return len;
+    }
+    char digits[4] = {'0', '0', '0', '0'};
+    memcpy(digits + 4 - len, start, len);
+    memcpy(packed, digits, sizeof(digits));
+    return len;
+}
+
+// Convert packed samples to ADC values, returns a mask with bit i set when sample i has a non-digit byte or when
+// bit i of multi is set (more than one digit) and the value is 0. The live path rejects "00" to "0000", only a
+// single '0' is a valid zero
+static uint32_t batch_convert_scalar(const uint32_t* packed, const size_t n, const uint32_t multi, uint16_t* adc)
+{
+    uint32_t invalid = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned char digits[4];
+        memcpy(digits, &packed[i], sizeof(digits));
+        unsigned int value = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            const unsigned int digit = digits[j] - (unsigned int)'0';
+            if (digit > 9)
+            {
+                invalid |= 1u << i;
+            }
+            value = value * 10 + digit;
+        }
+        if (value == 0 && (multi >> i & 1u))
+        {
+            invalid |= 1u << i;
+        }
+        adc[i] = (uint16_t)value;
+    }
+    return invalid;
+}
+
+static void batch_volume_scalar(const uint16_t* adc, const size_t n, uint8_t* volume)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        volume[i] = (uint8_t)batch_volume(adc[i]);
+    }
+}
+
+// Find delimiters from pos onwards, returns a bit mask of '\n' for the 32 bytes at pos (fewer at the end)
+static uint32_t batch_newlines_scalar(const char* buf, const size_t pos, const size_t len)
+{
+    uint32_t mask = 0;
+    for (size_t i = 0; i < 32 && pos + i < len; i++)
+    {
+        if (buf[pos + i] == '\n')
+        {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+#ifdef BATCH_X86
+
+static uint32_t batch_newlines_sse2(const char* buf, const size_t pos, const size_t len)
+{
+    if (len - pos < 32)
+    {
+        return batch_newlines_scalar(buf, pos, len);
+    }
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i lo = _mm_loadu_si128((const __m128i*)(buf + pos));
+    const __m128i hi = _mm_loadu_si128((const __m128i*)(buf + pos + 16));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, nl)) |
+        (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, nl)) << 16;
+}
+
+// Four samples: subtract '0', check every byte is at most 9, then weight the digits with 1000/100/10/1
+static uint32_t batch_convert4_sse2(const uint32_t* packed, const uint32_t multi, uint16_t* adc)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i weights = _mm_setr_epi16(1000, 100, 10, 1, 1000, 100, 10, 1);
+    const __m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)packed), _mm_set1_epi8('0'));
+    const __m128i digit_ok = _mm_cmpeq_epi8(_mm_max_epu8(digits, nine), nine);
+    const int valid = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(digit_ok, _mm_set1_epi32(-1))));
+
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), weights);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), weights);
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i values = _mm_unpacklo_epi64(lo, hi);
+    _mm_storel_epi64((__m128i*)adc, _mm_packs_epi32(values, values));
+    const int zero_value = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(values, zero)));
+    return (~(uint32_t)valid | ((uint32_t)zero_value & multi)) & 0xfu;
+}
+
+static uint32_t batch_convert_sse2(const uint32_t* packed, const size_t n, const uint32_t multi, uint16_t* adc)
+{
+    uint32_t invalid = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        invalid |= batch_convert4_sse2(packed + i, multi >> i, adc + i) << i;
+    }
+    return invalid | batch_convert_scalar(packed + i, n - i, multi >> i, adc + i) << i;
+}
+
+// Eight volumes at once: min(adc, 1021) * 25 >> 8, and 100 above 1020
+static void batch_volume_sse2(const uint16_t* adc, const size_t n, uint8_t* volume)
+{
+    const __m128i limit = _mm_set1_epi16(1020);
+    const __m128i full = _mm_set1_epi16(100);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m128i value = _mm_loadu_si128((const __m128i*)(adc + i));
+        const __m128i scaled = _mm_srli_epi16(_mm_mullo_epi16(_mm_min_epi16(value, limit), _mm_set1_epi16(25)), 8);
+        const __m128i high = _mm_cmpgt_epi16(value, limit);
+        const __m128i result = _mm_or_si128(_mm_and_si128(high, full), _mm_andnot_si128(high, scaled));
+        _mm_storel_epi64((__m128i*)(volume + i), _mm_packus_epi16(result, result));
+    }
+    batch_volume_scalar(adc + i, n - i, volume + i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t batch_newlines_avx2(const char* buf, const size_t pos, const size_t len)
+{
+    if (len - pos < 32)
+    {
+        return batch_newlines_scalar(buf, pos, len);
+    }
+    const __m256i data = _mm256_loadu_si256((const __m256i*)(buf + pos));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(data, _mm256_set1_epi8('\n')));
+}
+
+__attribute__((target("avx2")))
+static uint32_t batch_convert_avx2(const uint32_t* packed, const size_t n, const uint32_t multi, uint16_t* adc)
+{
+    uint32_t invalid = 0;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i weights = _mm256_setr_epi16(1000, 100, 10, 1, 1000, 100, 10, 1, 1000, 100, 10, 1, 1000, 100, 10, 1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256i digits = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(packed + i)),
+                                               _mm256_set1_epi8('0'));
+        const __m256i digit_ok = _mm256_cmpeq_epi8(_mm256_max_epu8(digits, nine), nine);
+        const int valid = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(digit_ok, _mm256_set1_epi32(-1))));
+
+        // Unpacking works per 128-bit lane, samples 0-3 sit in the low lane and 4-7 in the high one
+        __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(digits, zero), weights);
+        __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(digits, zero), weights);
+        lo = _mm256_add_epi32(lo, _mm256_srli_epi64(lo, 32));
+        hi = _mm256_add_epi32(hi, _mm256_srli_epi64(hi, 32));
+        lo = _mm256_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+        hi = _mm256_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i values = _mm256_unpacklo_epi64(lo, hi);
+        const __m256i packed16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(values, values), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(adc + i), _mm256_castsi256_si128(packed16));
+        const int zero_value = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(values, zero)));
+        invalid |= ((~(uint32_t)valid | ((uint32_t)zero_value & multi >> i)) & 0xffu) << i;
+    }
+    return invalid | batch_convert_sse2(packed + i, n - i, multi >> i, adc + i) << i;
+}
+
+__attribute__((target("avx2")))
+static void batch_volume_avx2(const uint16_t* adc, const size_t n, uint8_t* volume)
+{
+    const __m256i limit = _mm256_set1_epi16(1020);
+    const __m256i full = _mm256_set1_epi16(100);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m256i value = _mm256_loadu_si256((const __m256i*)(adc + i));
+        const __m256i scaled = _mm256_srli_epi16(
+            _mm256_mullo_epi16(_mm256_min_epi16(value, limit), _mm256_set1_epi16(25)), 8);
+        const __m256i high = _mm256_cmpgt_epi16(value, limit);
+        const __m256i result = _mm256_blendv_epi8(scaled, full, high);
+        const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(result, result), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)(volume + i), _mm256_castsi256_si128(bytes));
+    }
+    batch_volume_sse2(adc + i, n - i, volume + i);
+}
+
+#endif // BATCH_X86
+
+// Kernels of one instruction set
+struct batch_ops
+{
+    uint32_t (*newlines)(const char* buf, size_t pos, size_t len);
+    uint32_t (*convert)(const uint32_t* packed, size_t n, uint32_t multi, uint16_t* adc);
+    void (*volume)(const uint16_t* adc, size_t n, uint8_t* volume);
+};
+
+static struct batch_ops batch_get_ops(void)
+{
+    pthread_once(&batch_isa_once, batch_isa_detect);
+#ifdef BATCH_X86
+    if (batch_isa == BATCH_ISA_AVX2)
+    {
+        return (struct batch_ops){batch_newlines_avx2, batch_convert_avx2, batch_volume_avx2};
+    }
+    if (batch_isa == BATCH_ISA_SSE2)
+    {
+        return (struct batch_ops){batch_newlines_sse2, batch_convert_sse2, batch_volume_sse2};
+    }
+#endif
+    return (struct batch_ops){batch_newlines_scalar, batch_convert_scalar, batch_volume_scalar};
+}
+
+size_t batch_count_lines(const char* buf, const size_t len)
+{
+    const struct batch_ops ops = batch_get_ops();
+    size_t lines = 0;
+    for (size_t pos = 0; pos < len; pos += 32)
+    {
+        lines += (size_t)__builtin_popcount(ops.newlines(buf, pos, len));
+    }
+    return lines;
+}
+
+// Convert one group of packed samples and record the invalid ones, multi marks the samples of more than one digit
+static void batch_flush_group(const struct batch_ops* ops, const uint32_t* packed, uint32_t invalid,
+                              const uint32_t multi, const size_t n, struct batch_result* result)
+{
+    const size_t first = result->count;
+    invalid |= ops->convert(packed, n, multi, result->adc + first);
+    while (invalid != 0)
+    {
+        const size_t index = first + (size_t)__builtin_ctz(invalid);
+        invalid &= invalid - 1;
+        result->adc[index] = 0;
+        result->errors[result->error_count++] = index;
+    }
+    result->count += n;
+}
+
+size_t batch_parse(const char* buf, const size_t len, struct batch_result* result)
+{
+    const struct batch_ops ops = batch_get_ops();
+    result->count = 0;
+    result->error_count = 0;
+
+    uint32_t packed[BATCH_GROUP];
+    uint32_t invalid = 0; // Samples of the group rejected by their length
+    uint32_t multi = 0; // Samples of the group with more than one digit
+    size_t grouped = 0;
+    size_t start = 0; // First byte of the current sample
+    for (size_t pos = 0; pos < len; pos += 32)
+    {
+        uint32_t newlines = ops.newlines(buf, pos, len);
+        // A block holds at most 32 samples, check the capacity per sample only close to the end
+        const int room = result->capacity - result->count - grouped >= 32;
+        while (newlines != 0)
+        {
+            if (!room && result->count + grouped == result->capacity)
+            {
+                goto done;
+            }
+            const size_t end = pos + (size_t)__builtin_ctz(newlines);
+            newlines &= newlines - 1;
+            const size_t digits = batch_pack(buf, buf + start, buf + end, &packed[grouped]);
+            invalid |= (uint32_t)(digits == 0) << grouped;
+            multi |= (uint32_t)(digits > 1) << grouped;
+            grouped++;
+            start = end + 1;
+            if (grouped == BATCH_GROUP)
+            {
+                batch_flush_group(&ops, packed, invalid, multi, grouped, result);
+                grouped = 0;
+                invalid = 0;
+                multi = 0;
+            }
+        }
+    }
+done:
+    batch_flush_group(&ops, packed, invalid, multi, grouped, result);
+    ops.volume(result->adc, result->count, result->volume);
+    return start;
+}
+
+// One slice of a parallel parse
+struct batch_job
+{
+    const char* buf;
+    size_t len;
+    size_t lines;
+    struct batch_result result;
+};
+
+static void* batch_count_worker(void* arg)
+{
+    struct batch_job* job = arg;
+    job->lines = batch_count_lines(job->buf, job->len);
+    return nullptr;
+}
+
+static void* batch_parse_worker(void* arg)
+{
+    struct batch_job* job = arg;
+    batch_parse(job->buf, job->len, &job->result);
+    return nullptr;
+}
+
+// Run worker on every job, the first one on the calling thread
+static void batch_run(struct batch_job* jobs, const unsigned int count, void* (*worker)(void*))
+{
+    pthread_t threads[BATCH_MAX_THREADS];
+    int started[BATCH_MAX_THREADS] = {0};
+    for (unsigned int i = 1; i < count; i++)
+    {
+        started[i] = pthread_create(&threads[i], nullptr, worker, &jobs[i]) == 0;
+        if (!started[i])
+        {
+            worker(&jobs[i]);
+        }
+    }
+    worker(&jobs[0]);
+    for (unsigned int i = 1; i < count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(threads[i], nullptr);
+        }
+    }
+}
+
+size_t batch_parse_parallel(const char* buf, const size_t len, struct batch_result* result, unsigned int threads)
+{
+    if (threads > BATCH_MAX_THREADS)
+    {
+        threads = BATCH_MAX_THREADS;
+    }
+    const char* last = len > 0 ? memrchr(buf, '\n', len) : nullptr;
+    if (threads <= 1 || len < BATCH_PARALLEL_MIN || last == nullptr)
+    {
+        return batch_parse(buf, len, result);
+    }
+    batch_get_ops();
+
+    // Slices end right after a delimiter, so every sample belongs to exactly one of them
+    const size_t total = (size_t)(last - buf) + 1;
+    struct batch_job jobs[BATCH_MAX_THREADS];
+    unsigned int count = 0;
+    size_t begin = 0;
+    for (unsigned int i = 0; i < threads && begin < total; i++)
+    {
+        size_t end = total;
+        if (i + 1 < threads)
+        {
+            size_t target = begin + (total - begin) / (threads - i);
+            if (target <= begin)
+            {
+                target = begin + 1;
+            }
+            const char* cut = memchr(buf + target - 1, '\n', total - (target - 1));
+            end = (size_t)(cut - buf) + 1;
+        }
+        jobs[count++] = (struct batch_job){.buf = buf + begin, .len = end - begin};
+        begin = end;
+    }
+
+    batch_run(jobs, count, batch_count_worker);
+    size_t lines = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        lines += jobs[i].lines;
+    }
+    if (lines > result->capacity)
+    {
+        return batch_parse(buf, len, result);
+    }
+
+    // Every slice writes its samples and errors at its own offset, the error lists are joined afterwards
+    size_t base = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        jobs[i].result = (struct batch_result){
+            .adc = result->adc + base, .volume = result->volume + base, .errors = result->errors + base,
+            .capacity = jobs[i].lines
+        };
+        base += jobs[i].lines;
+    }
+    batch_run(jobs, count, batch_parse_worker);
+
+    result->count = 0;
+    result->error_count = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        for (size_t e = 0; e < jobs[i].result.error_count; e++)
+        {
+            result->errors[result->error_count++] = jobs[i].result.errors[e] + result->count;
+        }
+        result->count += jobs[i].result.count;
+    }
+    return total;
+}
@@ -0,0 +1,46 @@
+#ifndef BATCH_PARSE_H
+#define BATCH_PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bulk parsing of newline-delimited ADC samples, used to replay captured traffic and drain backlogs.
+// A sample is valid under the same rules as the live path (frame_parse): one to four decimal digits followed by
+// '\n', leading zeros are allowed but a sample of more than one digit must not be all zeros ("0" is valid, "00" is not). Delimiters are found and digits are validated and converted with AVX2 or SSE2 when the CPU
+// has them, with a scalar fallback otherwise.
+
+#define BATCH_MAX_DIGITS 4 // Longest valid sample, the device sends 10-bit values
+#define BATCH_PARALLEL_MIN (1u << 20) // Smaller inputs are not worth splitting across threads
+
+// Parse results, the arrays are allocated by the caller with room for capacity samples
+struct batch_result
+{
+    uint16_t* adc; // ADC value of every sample, 0 for an invalid one
+    uint8_t* volume; // Volume of every sample, 0 for an invalid one
+    size_t* errors; // Indices of invalid samples
+    size_t capacity; // Room in adc, volume and errors
+    size_t count; // Samples parsed
+    size_t error_count; // Invalid samples among them
+};
+
+// Number of complete samples (delimiters) in the buffer, sizes the result arrays
+size_t batch_count_lines(const char* buf, size_t len);
+
+// Parse complete samples of the buffer, returns the number of bytes consumed. Bytes after the last
+// delimiter, or after the last sample that fit into the result, are left for the next call
+size_t batch_parse(const char* buf, size_t len, struct batch_result* result);
+
+// Like batch_parse, large inputs are split at delimiters and parsed by up to threads workers
+size_t batch_parse_parallel(const char* buf, size_t len, struct batch_result* result, unsigned int threads);
+
+// Volume of an ADC value, the same mapping as the live path
+unsigned int batch_volume(unsigned int adc);
+
+// Instruction set used by the parser, "avx2", "sse2" or "scalar"
+const char* batch_parse_isa(void);
+
+// Use the kernels of another instruction set instead of the detected one, e.g. to compare them. Returns 0 on
+// success and 1 when the CPU lacks it or the name is unknown. Must not be called while a parse runs
+int batch_parse_set_isa(const char* isa);
+
+#endif // BATCH_PARSE_H
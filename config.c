@@ -0,0 +1,513 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+#include "tx_sched.h"
+
+// Supported baud rates and their termios speeds
+static const struct
+{
+    int baud;
+    speed_t speed;
+} config_bauds[] = {
+    {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+    {230400, B230400}, {460800, B460800}, {921600, B921600}, {1000000, B1000000}, {2000000, B2000000},
+};
+
+static const char* config_policies[] = {
+    [QUEUE_OVERFLOW_BLOCK] = "block",
+    [QUEUE_OVERFLOW_DROP_OLDEST] = "drop_oldest",
+    [QUEUE_OVERFLOW_DROP_NEWEST] = "drop_newest",
+    [QUEUE_OVERFLOW_COALESCE] = "coalesce",
+};
+
+static const char* config_alloc_modes[] = {
+    [CONFIG_ALLOC_ALLOW] = "allow",
+    [CONFIG_ALLOC_WARN] = "warn",
+    [CONFIG_ALLOC_ABORT] = "abort",
+};
+
+// Keys accepted in the config file, the command line flag is the key with '-' instead of '_'
+static const char* config_keys[] = {
+    "device", "baud", "vtime", "buffer_numbers", "coalesce_us", "mixer_control", "mixer_outputs",
+    "volume_queue", "volume_policy", "mixer_wait_ms", "mixer_cpu", "io", "tx_rate", "tx_budget", "trace",
+    "telemetry", "steady_alloc",
+};
+
+#define CONFIG_KEY_COUNT (sizeof(config_keys) / sizeof(config_keys[0]))
+
+void config_defaults(struct config* cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    strcpy(cfg->device, "/dev/ttyACM0");
+    cfg->baud = 115200;
+    cfg->vtime = 5;
+    cfg->buffer_numbers = 50;
+    cfg->coalesce_us = 5000;
+    strcpy(cfg->mixer_control, "Master");
+    cfg->volume_queue = 4;
+    cfg->volume_policy = QUEUE_OVERFLOW_COALESCE;
+    cfg->mixer_wait_ms = 100;
+    cfg->mixer_cpu = -1;
+    cfg->io_uring = 1;
+    cfg->tx_budget = 32;
+    strcpy(cfg->telemetry, TELEMETRY_DEFAULT_NAME);
+    cfg->steady_alloc = CONFIG_ALLOC_WARN;
+}
+
+// Parse a whole decimal number within [min, max], returns 0 on success
+static int config_parse_long(const char* value, const long min, const long max, long* out)
+{
+    char* end = nullptr;
+    errno = 0;
+    const long parsed = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || parsed < min || parsed > max)
+    {
+        return 1;
+    }
+    *out = parsed;
+    return 0;
+}
+
+// Copy a string value, returns 0 on success and 1 when it does not fit
+static int config_copy(char* dst, const size_t size, const char* value)
+{
+    if (strlen(value) >= size)
+    {
+        return 1;
+    }
+    strcpy(dst, value);
+    return 0;
+}
+
+int config_set(struct config* cfg, const char* key, const char* value)
+{
+    long number = 0;
+    if (strcmp(key, "device") == 0)
+    {
+        return value[0] == '\0' || config_copy(cfg->device, sizeof(cfg->device), value);
+    }
+    if (strcmp(key, "baud") == 0)
+    {
+        if (config_parse_long(value, 1, 4000000, &number) || config_baud_speed((int)number) == B0)
+        {
+            return 1;
+        }
+        cfg->baud = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "vtime") == 0)
+    {
+        if (config_parse_long(value, 0, 255, &number))
+        {
+            return 1;
+        }
+        cfg->vtime = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "buffer_numbers") == 0)
+    {
+        if (config_parse_long(value, 1, 100000, &number))
+        {
+            return 1;
+        }
+        cfg->buffer_numbers = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "coalesce_us") == 0)
+    {
+        if (config_parse_long(value, 0, 1000000, &number))
+        {
+            return 1;
+        }
+        cfg->coalesce_us = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "mixer_control") == 0)
+    {
+        // The name ends up quoted in a shell command
+        if (value[0] == '\0' || strchr(value, '\'') != nullptr)
+        {
+            return 1;
+        }
+        return config_copy(cfg->mixer_control, sizeof(cfg->mixer_control), value);
+    }
+    if (strcmp(key, "mixer_outputs") == 0)
+    {
+        // The list on its own is checked here so that it is reported like any other invalid value, against
+        // mixer_control in config_check once every key is read
+        struct mixer_map map;
+        mixer_map_init(&map, "");
+        if (mixer_map_add_list(&map, value) != 0)
+        {
+            return 1;
+        }
+        return config_copy(cfg->mixer_outputs, sizeof(cfg->mixer_outputs), value);
+    }
+    if (strcmp(key, "volume_queue") == 0)
+    {
+        if (config_parse_long(value, 1, 100000, &number))
+        {
+            return 1;
+        }
+        cfg->volume_queue = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "volume_policy") == 0)
+    {
+        for (size_t i = 0; i < sizeof(config_policies) / sizeof(config_policies[0]); i++)
+        {
+            if (strcmp(value, config_policies[i]) == 0)
+            {
+                cfg->volume_policy = (enum TQueueOverflowPolicy)i;
+                return 0;
+            }
+        }
+        return 1;
+    }
+    if (strcmp(key, "mixer_wait_ms") == 0)
+    {
+        if (config_parse_long(value, 1, 10000, &number))
+        {
+            return 1;
+        }
+        cfg->mixer_wait_ms = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "mixer_cpu") == 0)
+    {
+        if (config_parse_long(value, -1, 1023, &number))
+        {
+            return 1;
+        }
+        cfg->mixer_cpu = (int)number;
+        return 0;
+    }
+    if (strcmp(key, "io") == 0)
+    {
+        if (strcmp(value, "uring") == 0 || strcmp(value, "plain") == 0)
+        {
+            cfg->io_uring = strcmp(value, "uring") == 0;
+            return 0;
+        }
+        return 1;
+    }
+    if (strcmp(key, "tx_rate") == 0)
+    {
+        if (config_parse_long(value, 0, 1000000, &number))
+        {
+            return 1;
+        }
+        cfg->tx_rate = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "tx_budget") == 0)
+    {
+        if (config_parse_long(value, 1, TX_BUDGET_MAX, &number))
+        {
+            return 1;
+        }
+        cfg->tx_budget = (unsigned int)number;
+        return 0;
+    }
+    if (strcmp(key, "trace") == 0)
+    {
+        return config_copy(cfg->trace, sizeof(cfg->trace), value);
+    }
+    if (strcmp(key, "telemetry") == 0)
+    {
+        return config_copy(cfg->telemetry, sizeof(cfg->telemetry), value);
+    }
+    if (strcmp(key, "steady_alloc") == 0)
+    {
+        for (size_t i = 0; i < sizeof(config_alloc_modes) / sizeof(config_alloc_modes[0]); i++)
+        {
+            if (strcmp(value, config_alloc_modes[i]) == 0)
+            {
+                cfg->steady_alloc = (enum config_alloc_mode)i;
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return 1;
+}
+
+// Strip leading and trailing whitespace in place
+static char* config_trim(char* str)
+{
+    while (isspace((unsigned char)*str))
+    {
+        str++;
+    }
+    size_t len = strlen(str);
+    while (len > 0 && isspace((unsigned char)str[len - 1]))
+    {
+        str[--len] = '\0';
+    }
+    return str;
+}
+
+int config_load_file(struct config* cfg, const char* path, const int required)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        if (required)
+        {
+            printf("Unable to open config file %s\n", path);
+            return 1;
+        }
+        return 0;
+    }
+
+    char line[512];
+    int line_num = 0;
+    int result = 0;
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        line_num++;
+        char* comment = strchr(line, '#');
+        if (comment != nullptr)
+        {
+            *comment = '\0';
+        }
+        char* key = config_trim(line);
+        if (*key == '\0')
+        {
+            continue;
+        }
+        char* value = strchr(key, '=');
+        if (value == nullptr)
+        {
+            printf("Config %s:%d: expected key = value\n", path, line_num);
+            result = 1;
+            continue;
+        }
+        *value++ = '\0';
+        key = config_trim(key);
+        value = config_trim(value);
+        if (config_set(cfg, key, value) != 0)
+        {
+            printf("Config %s:%d: invalid %s = %s\n", path, line_num, key, value);
+            result = 1;
+        }
+    }
+    fclose(file);
+    return result;
+}
+
+static void config_usage(const char* prog)
+{
+    printf("Usage: %s [options]\n", prog);
+    printf("  -c, --config FILE        config file (default %s if it exists)\n", CONFIG_DEFAULT_FILE);
+    printf("      --device PATH        serial port device\n");
+    printf("      --baud RATE          baud rate\n");
+    printf("      --vtime N            port read timeout in tenths of a second (0 for no limit)\n");
+    printf("      --buffer-numbers N   numbers held in the receive buffer\n");
+    printf("      --coalesce-us N      delay before a plain read\n");
+    printf("      --mixer-control NAME amixer control to set\n");
+    printf("      --mixer-outputs LIST more controls, control[@card][:curve[:offset]],...\n");
+    printf("      --volume-queue N     capacity of the volume queue\n");
+    printf("      --volume-policy P    block, drop_oldest, drop_newest or coalesce\n");
+    printf("      --mixer-wait-ms N    longest idle sleep of the mixer thread\n");
+    printf("      --mixer-cpu N        pin the mixer thread to CPU N (-1 for none)\n");
+    printf("      --io uring|plain     serial I/O backend\n");
+    printf("      --tx-rate N          bytes per second sent to the device (0 for the line rate)\n");
+    printf("      --tx-budget N        bytes the device can take in one burst\n");
+    printf("      --trace FILE         write a latency trace\n");
+    printf("      --telemetry NAME     shared memory object for live values (empty to disable)\n");
+    printf("      --steady-alloc M     allow, warn or abort on own heap allocations after warm-up\n");
+    printf("      --replay FILE        parse a captured byte stream offline and exit\n");
+    printf("  -h, --help               show this help\n");
+    printf("Send SIGHUP to reload the config file.\n");
+}
+
+int config_parse_args(struct config_args* args, const int argc, char** argv)
+{
+    static char long_names[CONFIG_KEY_COUNT][32];
+    struct option options[CONFIG_KEY_COUNT + 4];
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++)
+    {
+        strcpy(long_names[i], config_keys[i]);
+        for (char* c = long_names[i]; *c != '\0'; c++)
+        {
+            if (*c == '_')
+            {
+                *c = '-';
+            }
+        }
+        options[i] = (struct option){long_names[i], required_argument, nullptr, 256 + (int)i};
+    }
+    options[CONFIG_KEY_COUNT] = (struct option){"config", required_argument, nullptr, 'c'};
+    options[CONFIG_KEY_COUNT + 1] = (struct option){"help", no_argument, nullptr, 'h'};
+    options[CONFIG_KEY_COUNT + 2] = (struct option){"replay", required_argument, nullptr, 'r'};
+    options[CONFIG_KEY_COUNT + 3] = (struct option){nullptr, 0, nullptr, 0};
+
+    memset(args, 0, sizeof(*args));
+    struct config check;
+    config_defaults(&check);
+    int opt;
+    optind = 1;
+    while ((opt = getopt_long(argc, argv, "c:h", options, nullptr)) != -1)
+    {
+        if (opt == 'c')
+        {
+            args->config_path = optarg;
+        }
+        else if (opt == 'r')
+        {
+            args->replay_path = optarg;
+        }
+        else if (opt == 'h')
+        {
+            config_usage(argv[0]);
+            return 2;
+        }
+        else if (opt >= 256 && opt < 256 + (int)CONFIG_KEY_COUNT)
+        {
+            const char* key = config_keys[opt - 256];
+            if (config_set(&check, key, optarg) != 0)
+            {
+                printf("Invalid value for --%s: %s\n", long_names[opt - 256], optarg);
+                return 1;
+            }
+            if (args->count == CONFIG_MAX_ARGS)
+            {
+                printf("Too many options\n");
+                return 1;
+            }
+            args->keys[args->count] = key;
+            args->values[args->count] = optarg;
+            args->count++;
+        }
+        else
+        {
+            config_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+    {
+        printf("Unexpected argument %s\n", argv[optind]);
+        return 1;
+    }
+    return 0;
+}
+
+// Checks of values that depend on each other, independent of the order the keys came in, returns 0 when valid
+static int config_check(const struct config* cfg)
+{
+    struct mixer_map map;
+    mixer_map_init(&map, cfg->mixer_control);
+    const enum mixer_map_status status = mixer_map_add_list(&map, cfg->mixer_outputs);
+    if (status != MIXER_MAP_OK)
+    {
+        printf("Config: mixer_outputs = %s with mixer_control = %s: %s\n", cfg->mixer_outputs, cfg->mixer_control,
+               mixer_map_status_text(status));
+        return 1;
+    }
+    return 0;
+}
+
+int config_build(struct config* cfg, const struct config_args* args)
+{
+    config_defaults(cfg);
+    const char* path = args->config_path != nullptr ? args->config_path : CONFIG_DEFAULT_FILE;
+    if (config_load_file(cfg, path, args->config_path != nullptr) != 0)
+    {
+        return 1;
+    }
+    for (int i = 0; i < args->count; i++)
+    {
+        config_set(cfg, args->keys[i], args->values[i]);
+    }
+    return config_check(cfg);
+}
+
+void config_merge(struct config* next, const struct config* active, const struct config_apply* apply)
+{
+    // The port and the I/O engine stay attached until restart
+    if (strcmp(next->device, active->device) != 0)
+    {
+        printf("Changing the device needs a restart, keeping %s\n", active->device);
+        strcpy(next->device, active->device);
+    }
+    if (next->io_uring != active->io_uring)
+    {
+        printf("Changing the I/O backend needs a restart, keeping %s\n", active->io_uring ? "uring" : "plain");
+        next->io_uring = active->io_uring;
+    }
+    // The segment stays mapped until restart
+    if (strcmp(next->telemetry, active->telemetry) != 0)
+    {
+        printf("Changing the telemetry segment needs a restart, keeping %s\n",
+               active->telemetry[0] != '\0' ? active->telemetry : "(off)");
+        strcpy(next->telemetry, active->telemetry);
+    }
+    if ((next->baud != active->baud || next->vtime != active->vtime) && apply->port(next->baud, next->vtime) != 0)
+    {
+        printf("Unable to reinitialize UART, keeping baud rate and timeout\n");
+        next->baud = active->baud;
+        next->vtime = active->vtime;
+    }
+    if (apply->buffer(config_buffer_bytes(next)) != 0)
+    {
+        printf("Memory allocation failed, keeping the buffer size\n");
+        next->buffer_numbers = active->buffer_numbers;
+    }
+}
+
+size_t config_buffer_bytes(const struct config* cfg)
+{
+    return (size_t)cfg->buffer_numbers * CONFIG_FRAME_BYTES;
+}
+
+speed_t config_baud_speed(const int baud)
+{
+    for (size_t i = 0; i < sizeof(config_bauds) / sizeof(config_bauds[0]); i++)
+    {
+        if (config_bauds[i].baud == baud)
+        {
+            return config_bauds[i].speed;
+        }
+    }
+    return B0;
+}
+
+const char* config_policy_name(const enum TQueueOverflowPolicy policy)
+{
+    return config_policies[policy];
+}
+
+const char* config_alloc_mode_name(const enum config_alloc_mode mode)
+{
+    return config_alloc_modes[mode];
+}
+
+void config_print(const struct config* cfg)
+{
+    printf("Configuration:\n");
+    printf("  device = %s\n", cfg->device);
+    printf("  baud = %d\n", cfg->baud);
+    printf("  vtime = %d\n", cfg->vtime);
+    printf("  buffer_numbers = %u\n", cfg->buffer_numbers);
+    printf("  coalesce_us = %u\n", cfg->coalesce_us);
+    printf("  mixer_control = %s\n", cfg->mixer_control);
+    printf("  mixer_outputs = %s\n", cfg->mixer_outputs[0] != '\0' ? cfg->mixer_outputs : "(none)");
+    printf("  volume_queue = %u\n", cfg->volume_queue);
+    printf("  volume_policy = %s\n", config_policy_name(cfg->volume_policy));
+    printf("  mixer_wait_ms = %u\n", cfg->mixer_wait_ms);
+    printf("  mixer_cpu = %d\n", cfg->mixer_cpu);
+    printf("  io = %s\n", cfg->io_uring ? "uring" : "plain");
+    printf("  tx_rate = %u%s\n", cfg->tx_rate, cfg->tx_rate == 0 ? " (line rate)" : "");
+    printf("  tx_budget = %u\n", cfg->tx_budget);
+    printf("  trace = %s\n", cfg->trace[0] != '\0' ? cfg->trace : "(off)");
+    printf("  telemetry = %s\n", cfg->telemetry[0] != '\0' ? cfg->telemetry : "(off)");
+    printf("  steady_alloc = %s\n", config_alloc_mode_name(cfg->steady_alloc));
+}
@@ -0,0 +1,100 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <termios.h>
+#include "TQueue.h"
+#include "frame.h"
+#include "mixer_map.h"
+
+// Runtime configuration.
+// Values come from the built-in defaults, then the config file (key = value lines, # starts a comment),
+// then the command line flags, which always win. SIGHUP rebuilds the configuration the same way.
+
+#define CONFIG_DEFAULT_FILE "spc.conf" // Read from the working directory when no --config is given
+#define CONFIG_FRAME_BYTES (FRAME_MAX_DIGITS + 1) // Longest frame, the digits and the end byte
+#define CONFIG_MAX_ARGS 32 // Command line flags remembered for reloads
+
+// What happens when the program's own code allocates after warm-up, libc-internal allocations are not seen
+enum config_alloc_mode
+{
+    CONFIG_ALLOC_ALLOW, // Only count it
+    CONFIG_ALLOC_WARN, // Print a warning
+    CONFIG_ALLOC_ABORT, // Abort, for verifying that the per-sample path does not allocate
+};
+
+struct config
+{
+    char device[256]; // Serial port device path
+    int baud; // Baud rate, one of the termios speeds
+    int vtime; // Read timeout of the port in tenths of a second, 0 for none (mixer changes still wake the loop)
+    unsigned int buffer_numbers; // Numbers held in the receive buffer before reading stops
+    unsigned int coalesce_us; // Plain I/O backend, delay before reading to let more bytes arrive
+    char mixer_control[64]; // amixer simple control that follows the knob
+    char mixer_outputs[MIXER_OUTPUTS_SIZE]; // Further controls driven by the knob, see mixer_map.h
+    unsigned int volume_queue; // Capacity of the queue between the reader and the mixer thread
+    enum TQueueOverflowPolicy volume_policy; // Overflow policy of that queue
+    unsigned int mixer_wait_ms; // Longest sleep of the mixer thread before it checks the running flag
+    int mixer_cpu; // CPU the mixer thread is pinned to, -1 for no pinning
+    int io_uring; // Use the io_uring backend when available
+    unsigned int tx_rate; // Bytes per second sent to the device, 0 for the line rate of baud
+    unsigned int tx_budget; // Bytes the device can take in one burst
+    char trace[256]; // Latency trace output file, empty to disable tracing
+    char telemetry[256]; // Shared memory object the live values are published in, empty to disable
+    enum config_alloc_mode steady_alloc; // Handling of heap allocations after warm-up
+};
+
+// Command line state kept for reloads
+struct config_args
+{
+    const char* config_path; // Config file given by --config, nullptr for CONFIG_DEFAULT_FILE
+    const char* replay_path; // Captured byte stream given by --replay, parsed offline instead of opening the port
+    int count; // Remembered key/value pairs
+    const char* keys[CONFIG_MAX_ARGS];
+    const char* values[CONFIG_MAX_ARGS];
+};
+
+// Fill in the built-in defaults
+void config_defaults(struct config* cfg);
+
+// Set one key from its text value, returns 0 on success and 1 for an unknown key or an invalid value
+int config_set(struct config* cfg, const char* key, const char* value);
+
+// Apply a config file, returns 0 on success and 1 on failure. A missing file is only an error when required
+int config_load_file(struct config* cfg, const char* path, int required);
+
+// Parse the command line into args, returns 0 on success, 1 on error and 2 when help was printed
+int config_parse_args(struct config_args* args, int argc, char** argv);
+
+// Build the configuration from defaults, the config file and the remembered flags, then check the values that
+// depend on each other, returns 0 on success
+int config_build(struct config* cfg, const struct config_args* args);
+
+// Settings a reload applies to the running program, each returns 0 on success
+struct config_apply
+{
+    int (*port)(int baud, int vtime); // Reinitialize the port
+    int (*buffer)(size_t bytes); // Make room for a receive buffer of this many bytes
+};
+
+// Merge a reloaded configuration next with the active one. Keys that need a restart (device, io, telemetry) keep
+// their active values, baud and vtime are kept when the port cannot be reinitialized and buffer_numbers when the
+// buffer cannot grow. Every kept value is reported
+void config_merge(struct config* next, const struct config* active, const struct config_apply* apply);
+
+// Receive buffer capacity in bytes
+size_t config_buffer_bytes(const struct config* cfg);
+
+// termios speed of the configured baud rate, B0 when it is not supported
+speed_t config_baud_speed(int baud);
+
+// Name of an overflow policy as used in the config file
+const char* config_policy_name(enum TQueueOverflowPolicy policy);
+
+// Name of an allocation mode as used in the config file
+const char* config_alloc_mode_name(enum config_alloc_mode mode);
+
+// Print the active configuration
+void config_print(const struct config* cfg);
+
+#endif // CONFIG_H
@@ -0,0 +1,131 @@
+#include "frame.h"
+#include <ctype.h>
+#include <stdlib.h>
+
+// Function to check if a string is a valid number, leading zeros are removed in place.
+// Returns 0 for a valid number, -1 when zeros were removed and 1 for anything else
+static char str_num_checker(char* num)
+{
+    unsigned int digits = 0;
+    unsigned char changed = 0;
+    while (num[digits] != '\0')
+    {
+        digits++;
+    }
+    if (digits == 0)
+    {
+        return 1;
+    }
+    for (unsigned int i = 0; i < digits; i++)
+    {
+        if (!isdigit((unsigned char)num[i]))
+        {
+            return 1;
+        }
+    }
+    for (unsigned int i = 0; i < digits; i++)
+    {
+        if (num[0] == '0' && digits > 1)
+        {
+            changed = 1;
+            for (unsigned int j = 1; j <= digits - i; j++)
+            {
+                num[j - 1] = num[j];
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (changed)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+size_t frame_feed(struct TQueue* bytes, unsigned int* ends, const char* data, const size_t len,
+                  const struct timespec* stamp)
+{
+    size_t queued = 0;
+    while (queued < len && queue_push(bytes, (TQueueElement){.iData = data[queued], .iStamp = *stamp}))
+    {
+        if (data[queued] == '\n')
+        {
+            (*ends)++;
+        }
+        queued++;
+    }
+    return queued;
+}
+
+enum frame_status frame_take(struct TQueue* bytes, unsigned int* ends, char* frame, size_t* len,
+                             struct timespec* stamp)
+{
+    TQueueElement element;
+    size_t taken = 0;
+    int complete = 0;
+    // Read characters from the queue until a complete number is found
+    while (!complete && queue_front(bytes, &element))
+    {
+        queue_pop(bytes);
+        frame[taken] = element.iData;
+        if (taken == 0)
+        {
+            *stamp = element.iStamp;
+        }
+        if (element.iData == '\n')
+        {
+            complete = 1;
+            (*ends)--;
+        }
+        taken++;
+        if (taken == FRAME_MAX_BYTES)
+        {
+            // Empty frames right behind a runaway belong to it
+            while (queue_front(bytes, &element) && element.iData == '\n')
+            {
+                queue_pop(bytes);
+                (*ends)--;
+            }
+            break;
+        }
+    }
+    *len = taken;
+    return complete ? FRAME_OK : FRAME_RUNAWAY;
+}
+
+enum frame_status frame_parse(const char* frame, const size_t len, unsigned int* adc)
+{
+    // The end byte is the last one taken
+    const size_t pos = len - 1;
+    if (len == 0 || pos > FRAME_MAX_DIGITS)
+    {
+        return FRAME_TOO_LONG;
+    }
+    char number[FRAME_MAX_DIGITS + 1];
+    for (size_t i = 0; i < pos; i++)
+    {
+        number[i] = frame[i];
+    }
+    number[pos] = '\0';
+
+    const char checked = str_num_checker(number);
+    if (checked == 1 || number[0] == '\0')
+    {
+        return FRAME_INVALID;
+    }
+    *adc = (unsigned int)strtol(number, nullptr, 10);
+    return FRAME_OK;
+}
+
+unsigned int frame_volume(const unsigned int adc)
+{
+    if (adc > 1020)
+    {
+        return 100;
+    }
+    const unsigned int volume = (100 * adc) / 1024;
+    return volume > 100 ? 100 : volume;
+}
@@ -0,0 +1,43 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <time.h>
+#include "TQueue.h"
+
+// Framing and validation of the live sample stream.
+// The device sends every ADC value as decimal digits followed by '\n'. Received bytes wait in a bounded TQueue
+// together with the number of end bytes among them, a frame is taken once at least one end byte is queued.
+// A frame is valid with one to four characters before the end byte that are all digits. Leading zeros are
+// removed, a number that consists of zeros only is valid only as a single "0".
+
+#define FRAME_MAX_BYTES 6 // Bytes taken without an end byte before the frame is given up
+#define FRAME_MAX_DIGITS 4 // Longest valid number, the device sends 10-bit values
+
+enum frame_status
+{
+    FRAME_OK, // A valid number
+    FRAME_RUNAWAY, // No end byte within FRAME_MAX_BYTES, the bytes are dropped
+    FRAME_TOO_LONG, // More than FRAME_MAX_DIGITS characters before the end byte
+    FRAME_INVALID, // Not a number
+};
+
+// Queue received bytes, all stamped with the time of their read. Stops when the queue is full, returns the number
+// of bytes queued. ends is increased by the end bytes among them
+size_t frame_feed(struct TQueue* bytes, unsigned int* ends, const char* data, size_t len,
+                  const struct timespec* stamp);
+
+// Take the bytes of one frame off the queue, which must hold at least one end byte. frame receives up to
+// FRAME_MAX_BYTES bytes, len their count and stamp the stamp of the first one. Returns FRAME_OK or FRAME_RUNAWAY,
+// a runaway also drops the end bytes directly following it
+enum frame_status frame_take(struct TQueue* bytes, unsigned int* ends, char* frame, size_t* len,
+                             struct timespec* stamp);
+
+// Validate a frame taken by frame_take and convert it, returns FRAME_OK and stores the value in adc, or
+// FRAME_TOO_LONG or FRAME_INVALID
+enum frame_status frame_parse(const char* frame, size_t len, unsigned int* adc);
+
+// Volume in percent of an ADC value
+unsigned int frame_volume(unsigned int adc);
+
+#endif // FRAME_H
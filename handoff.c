@@ -0,0 +1,114 @@
+#include "handoff.h"
+#include <time.h>
+
+// Wait on the condition for at most wait_ms, the mutex must be locked by the caller
+static void handoff_wait(struct handoff* handoff)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += (long)handoff->wait_ms * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&handoff->cond, &handoff->mutex, &deadline);
+}
+
+int handoff_init(struct handoff* handoff, const size_t capacity, const enum TQueueOverflowPolicy policy,
+                 const unsigned int wait_ms)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&handoff->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&handoff->mutex, nullptr);
+    queue_init_bounded(&handoff->queue, capacity, policy);
+    handoff->wait_ms = wait_ms;
+    handoff->open = true;
+    return queue_reserve(&handoff->queue, capacity) ? 0 : 1;
+}
+
+int handoff_configure(struct handoff* handoff, const size_t capacity, const enum TQueueOverflowPolicy policy,
+                      const unsigned int wait_ms)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    // The new policy decides what happens to samples over the new capacity
+    queue_set_policy(&handoff->queue, policy);
+    queue_set_capacity(&handoff->queue, capacity);
+    handoff->wait_ms = wait_ms;
+    const bool reserved = queue_reserve(&handoff->queue, capacity);
+    // A producer waiting for room may not have to wait any more
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->mutex);
+    return reserved ? 0 : 1;
+}
+
+bool handoff_push(struct handoff* handoff, const TQueueElement sample)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    bool pushed = handoff->open && queue_push(&handoff->queue, sample);
+    // Backpressure, wait until the consumer makes room
+    while (!pushed && handoff->open && queue_policy(&handoff->queue) == QUEUE_OVERFLOW_BLOCK)
+    {
+        handoff_wait(handoff);
+        pushed = handoff->open && queue_push(&handoff->queue, sample);
+    }
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->mutex);
+    return pushed;
+}
+
+bool handoff_pop(struct handoff* handoff, TQueueElement* sample)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    while (handoff->open && queue_is_empty(&handoff->queue))
+    {
+        handoff_wait(handoff);
+    }
+    const bool popped = handoff->open && queue_front(&handoff->queue, sample) && queue_pop(&handoff->queue);
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->mutex);
+    return popped;
+}
+
+size_t handoff_drain(struct handoff* handoff, TQueueElement* sample)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    const size_t taken = queue_back(&handoff->queue, sample) ? queue_size(&handoff->queue) : 0;
+    while (queue_pop(&handoff->queue))
+    {
+    }
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->mutex);
+    return taken;
+}
+
+bool handoff_is_empty(struct handoff* handoff)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    const bool empty = queue_is_empty(&handoff->queue);
+    pthread_mutex_unlock(&handoff->mutex);
+    return empty;
+}
+
+size_t handoff_dropped(struct handoff* handoff)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    const size_t dropped = queue_dropped(&handoff->queue);
+    pthread_mutex_unlock(&handoff->mutex);
+    return dropped;
+}
+
+void handoff_close(struct handoff* handoff)
+{
+    pthread_mutex_lock(&handoff->mutex);
+    handoff->open = false;
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->mutex);
+}
+
+void handoff_destroy(struct handoff* handoff)
+{
+    queue_destroy(&handoff->queue);
+    pthread_cond_destroy(&handoff->cond);
+    pthread_mutex_destroy(&handoff->mutex);
+}
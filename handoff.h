@@ -0,0 +1,54 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "TQueue.h"
+
+// Hand-over of samples from one thread to another.
+// A bounded TQueue guarded by a mutex, with a condition variable signalled on every push and pop. With the
+// QUEUE_OVERFLOW_BLOCK policy a full queue makes the producer wait (backpressure), the other policies never
+// block the producer. Waits are bounded by wait_ms and end early once the handoff is closed.
+
+struct handoff
+{
+    struct TQueue queue; // Samples waiting for the consumer
+    pthread_mutex_t mutex; // Guards everything in the struct
+    pthread_cond_t cond; // Signals a push, a pop or closing
+    unsigned int wait_ms; // Longest single wait before the open flag is checked again
+    bool open; // Cleared by handoff_close, waiters give up
+};
+
+// Set up an open handoff with preallocated queue nodes, returns 0 on success and 1 when the nodes could not be
+// allocated (the queue then allocates while running)
+int handoff_init(struct handoff* handoff, size_t capacity, enum TQueueOverflowPolicy policy, unsigned int wait_ms);
+
+// Change the capacity, policy and wait of a running handoff, returns 0 on success and 1 like handoff_init.
+// Samples over a smaller capacity are dropped as the new policy says and counted in handoff_dropped
+int handoff_configure(struct handoff* handoff, size_t capacity, enum TQueueOverflowPolicy policy,
+                      unsigned int wait_ms);
+
+// Hand a sample over, returns true if it was queued (or coalesced) and false if it was dropped or the handoff
+// was closed while waiting for room
+bool handoff_push(struct handoff* handoff, TQueueElement sample);
+
+// Take the oldest sample, blocks until one is available, returns false once the handoff is closed
+bool handoff_pop(struct handoff* handoff, TQueueElement* sample);
+
+// Take every waiting sample without blocking, sample is replaced by the newest one. Returns the number taken
+size_t handoff_drain(struct handoff* handoff, TQueueElement* sample);
+
+// True when no sample is waiting
+bool handoff_is_empty(struct handoff* handoff);
+
+// Samples lost to a full queue
+size_t handoff_dropped(struct handoff* handoff);
+
+// Release all waiters, later pushes and pops fail
+void handoff_close(struct handoff* handoff);
+
+// Free the queue, the handoff must be closed and no thread may use it any more
+void handoff_destroy(struct handoff* handoff);
+
+#endif // HANDOFF_H
@@ -1,33 +1,59 @@
 #define _GNU_SOURCE
-#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <termios.h>
+#include <sys/resource.h>
 #include "TQueue.h"
+#include "alloc_stats.h"
+#include "batch_parse.h"
+#include "config.h"
+#include "frame.h"
+#include "handoff.h"
+#include "mixer_map.h"
+#include "serial_io.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "tx_sched.h"
+#include "volume_state.h"
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <time.h>
 
-#define PORT "/dev/ttyACM0"
+// The receive buffer always blocks: reads never take more than its free space, so the other policies would never
+// act, and dropping or merging bytes would only split frames. Staleness is handled by volume_policy instead
+#define BUFFER_QUEUE_POLICY QUEUE_OVERFLOW_BLOCK
 
 // Global variables
 int port = -1; // Port file descriptor
 char* buffer = nullptr; // Buffer for reading data
-char* command = nullptr; // Command string
+size_t buffer_size = 0; // Allocated size of buffer
 
-static int running = 1; // Running flag
+struct config cfg; // Active configuration
+struct config_args cfg_args; // Command line, kept for reloads
+pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards cfg and the outputs handed to the mixer thread
+struct mixer_map mixer_outputs_next; // Outputs the mixer thread picks up when the generation changes
+unsigned int mixer_outputs_generation = 0;
+
+static volatile sig_atomic_t running = 1; // Running flag of the main loop, cleared by the exit signal handler
+static volatile sig_atomic_t exit_signal = 0; // Signal that stopped the main loop
+static atomic_int mixer_running = 1; // Running flag of the mixer thread, cleared by exit_cleanup or a fatal error
 static int thread_running = 0; // Thread running flag
+static volatile sig_atomic_t reload_requested = 0; // SIGHUP received, reload the configuration
+static int tx_defer_flush = 0; // The main loop submits the bytes the TX scheduler queued
 
 struct TQueue buffer_queue; // Queue for buffering data
-struct TQueue volume_queue; // Queue for buffering volume data
+struct handoff volume_handoff; // Volumes passed from the main loop to the mixer thread
 
 pthread_t thread_amixer;
 
 // Function to initialize UART communication
-int UART_Init(const int port)
+int UART_Init(const int port, const speed_t speed, const int vtime)
 {
     struct termios Serial;
     if (tcgetattr(port, &Serial))
@@ -35,8 +61,8 @@ int UART_Init(const int port)
         printf("Unable to get terminal attributes\n");
         return 1;
     }
-    cfsetispeed(&Serial, B115200);
-    cfsetospeed(&Serial, B115200);
+    cfsetispeed(&Serial, speed);
+    cfsetospeed(&Serial, speed);
 
     Serial.c_cflag &= ~CSIZE;
     Serial.c_cflag |= CS8;
@@ -51,7 +77,7 @@ int UART_Init(const int port)
 
     // Set timeout
     Serial.c_cc[VMIN] = 0;
-    Serial.c_cc[VTIME] = 5;
+    Serial.c_cc[VTIME] = vtime;
 
     tcflush(port, TCIOFLUSH); // Flush input and output registers
 
@@ -63,11 +89,29 @@ int UART_Init(const int port)
     return 0;
 }
 
-// Signal handler for cleanup on exit
+// Signal handler for SIGHUP, the configuration is reloaded by the main loop
+void signal_reload_handler(const int signum)
+{
+    (void)signum;
+    reload_requested = 1;
+    serial_io_wake(); // The signal may be delivered to another thread than the one waiting for the port
+}
+
+// Signal handler for exit signals, only stops the main loop, which then cleans up
 void signal_exit_handler(const int signum)
 {
-    printf("Caught signal %d\n", signum);
+    exit_signal = signum;
+    running = 0;
+    serial_io_wake();
+}
+
+// Cleanup on exit, called from the main thread only (the TX scheduler and the queues are not async-signal-safe)
+void exit_cleanup(const int code)
+{
     running = 0;
+    atomic_store(&mixer_running, 0);
+    alloc_steady_end();
+    handoff_close(&volume_handoff);
 
     if (thread_running)
     {
@@ -78,11 +122,29 @@ void signal_exit_handler(const int signum)
     }
 
 
-    //Send reset byte to the device
+    volume_watch_stop();
+
+    // Readers see the segment closed
+    telemetry_close();
+
+    //Send reset byte to the device, it overtakes waiting volume echoes, which are pointless after a reset
     printf("Sending reset byte now...\n");
-    constexpr char reset = 'r';
-    write(port, &reset, 1);
-    write(port, "\n", 1);
+    tx_clear(TX_PRIORITY_VOLUME);
+    tx_send(TX_PRIORITY_CONTROL, "r\n", 2);
+    tx_defer_flush = 0;
+    if (tx_finish(1000) != 0)
+    {
+        printf("Unable to send reset byte\n");
+    }
+    const struct tx_stats tx = tx_get_stats();
+    printf("TX: %lu bytes, %lu control messages, %lu volume echoes, %lu superseded, %lu throttled\n", tx.bytes,
+           tx.messages[TX_PRIORITY_CONTROL], tx.messages[TX_PRIORITY_VOLUME], tx.superseded, tx.throttled);
+
+    // Finish queued writes before the port is closed
+    const struct serial_io_stats io_stats = serial_io_get_stats();
+    printf("Serial I/O (%s): %lu syscalls, %lu reads, %lu writes\n", serial_io_backend(), io_stats.syscalls,
+           io_stats.reads, io_stats.writes);
+    serial_io_close();
 
     if (port >= 0)
     {
@@ -96,19 +158,36 @@ void signal_exit_handler(const int signum)
         printf("Detected allocated memory, releasing now...");
         free(buffer);
         buffer = nullptr;
-        printf("RELEASED\n");
-    }
-    if (command != nullptr)
-    {
-        printf("Detected allocated memory, releasing now...");
-        free(command);
-        command = nullptr;
+        buffer_size = 0;
         printf("RELEASED\n");
     }
 
+    // Report elements lost to full queues
+    printf("Queue drops: buffer %zu, volume %zu\n", queue_dropped(&buffer_queue), handoff_dropped(&volume_handoff));
+
     // Destroy the buffer queue
     queue_destroy(&buffer_queue);
-    queue_destroy(&volume_queue);
+    handoff_destroy(&volume_handoff);
+
+    // Memory footprint of the run
+    if (alloc_stats_available())
+    {
+        const struct alloc_stats heap = alloc_get_stats();
+        printf("Heap: %lu allocations, %lu frees, peak %zu bytes, %lu in the steady state\n", heap.allocs, heap.frees,
+               heap.peak_bytes, heap.steady_allocs);
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        printf("Peak RSS: %ld KiB\n", usage.ru_maxrss);
+    }
+
+    if (trace_is_open())
+    {
+        printf("Detected opened trace file, closing now...");
+        trace_close();
+        printf("CLOSED\n");
+    }
 
     printf("Sanity checked\n");
     printf("Exiting...\n");
@@ -129,49 +208,7 @@ void signal_exit_handler(const int signum)
         kill(terminal_pid, SIGTERM);
     }
 
-    exit(signum);
-}
-
-// Function to check if a string is a valid number
-char str_num_checker(char* num)
-{
-    unsigned int digits = 0;
-    unsigned char changed = 0;
-    while (num[digits] != '\0')
-    {
-        digits++;
-    }
-    if (digits == 0)
-    {
-        return 1;
-    }
-    for (unsigned int i = 0; i < digits; i++)
-    {
-        if (!isdigit(num[i]))
-        {
-            return 1;
-        }
-    }
-    for (unsigned int i = 0; i < digits; i++)
-    {
-        if (num[0] == '0' && digits > 1)
-        {
-            changed = 1;
-            for (unsigned int j = 1; j <= digits - i; j++)
-            {
-                num[j - 1] = num[j];
-            }
-        }
-        else
-        {
-            break;
-        }
-    }
-    if (changed)
-    {
-        return -1;
-    }
-    return 0;
+    exit(code);
 }
 
 // Function to count the number of digits in a number
@@ -200,124 +237,410 @@ void* amixer_thread(void* arg)
 {
     pthread_setname_np(pthread_self(), "BPC_SPC_Set_Volume_Thread");
     printf("Set volume helper thread started with thread id: %ld\n", pthread_self());
-    while (running)
+
+    // An amixer that exits early makes writing its commands fail with EPIPE instead of ending the program
+    sigset_t pipe_signal;
+    sigemptyset(&pipe_signal);
+    sigaddset(&pipe_signal, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_signal, nullptr);
+
+    struct mixer_map outputs; // Owned by this thread, replaced when the outputs are reconfigured
+    unsigned int outputs_generation = 0;
+    while (atomic_load(&mixer_running))
     {
-        if (queue_is_empty(&volume_queue))
+        TQueueElement sample;
+        if (!handoff_pop(&volume_handoff, &sample))
         {
             continue;
         }
-        char volume;
-        queue_front(&volume_queue, &volume);
-        queue_pop(&volume_queue);
-        unsigned int size = 0;
-        switch (count_digits(volume))
+        // Dispatch stage, samples queued meanwhile are merged and only the newest volume is applied
+        const size_t merged = handoff_drain(&volume_handoff, &sample);
+        if (merged > 0)
         {
-        case 1:
-            command = (char*)malloc(21 * sizeof(char)); // 21
-            if (command == nullptr)
-            {
-                printf("Memory allocation for command failed\n");
-                signal_exit_handler(-1);
-            }
-            size = 21;
-            break;
-        case 2:
-            command = (char*)malloc(22 * sizeof(char)); // 22
-            if (command == nullptr)
-            {
-                printf("Memory allocation for command failed\n");
-                signal_exit_handler(-1);
-            }
-            size = 22;
-            break;
-        case 3:
-            command = (char*)malloc(23 * sizeof(char)); // 23
-            if (command == nullptr)
-            {
-                printf("Memory allocation for command failed\n");
-                signal_exit_handler(-1);
-            }
-            size = 23;
-            break;
-        default:
+            printf("%zu newer samples merged, applying sample %u\n", merged, sample.iSeq);
+        }
+        const char volume = sample.iData;
+        struct timespec apply_start;
+        trace_now(&apply_start);
+
+        pthread_mutex_lock(&config_mutex);
+        if (outputs_generation != mixer_outputs_generation)
+        {
+            outputs = mixer_outputs_next;
+            outputs_generation = mixer_outputs_generation;
+        }
+        pthread_mutex_unlock(&config_mutex);
+        // Another application may have changed the primary control
+        outputs.outputs[0].applied = volume_state_mixer();
+
+        // Every output already has its level, nothing to spawn
+        if (mixer_map_pending(&outputs, volume) == 0)
+        {
+            printf("Mixer already at %d, sample %u skipped\n", volume, sample.iSeq);
+            continue;
+        }
+
+        const unsigned int digits = count_digits(volume);
+        if (digits > 3)
+        {
+            // The main loop sees the thread stopped and cleans up
             printf("Invalid command length\n");
-            signal_exit_handler(-1);
+            atomic_store(&mixer_running, 0);
+            serial_io_wake();
+            break;
         }
 
-        snprintf(command, size, "amixer set Master %d%%", volume);
         printf("\n");
-        const int result = system(command);
-        if (result != 0)
+        volume_state_applying(volume);
+        const unsigned int failed = mixer_map_apply(&outputs, volume);
+        if (failed != 0)
+        {
+            printf("Error while executing command (%u of the mixer groups failed)\n", failed);
+        }
+        // The main loop publishes the apply in the telemetry
+        struct timespec apply_end;
+        trace_now(&apply_end);
+        if (outputs.outputs[0].applied == volume)
+        {
+            volume_state_applied(volume, handoff_is_empty(&volume_handoff), &apply_end);
+        }
+        else
         {
-            printf("Error while executing command\n");
+            volume_state_applying(VOLUME_UNKNOWN);
         }
-        free(command);
-        command = nullptr;
+
+        // Report how stale the sample was by the time the mixer got it
+        trace_span("apply", sample.iSeq, &apply_start, &apply_end);
+        trace_sample(sample.iSeq, &sample.iStamp, &apply_end);
+        printf("Sample %u applied, latency %.3f ms (queued %.3f ms)\n", sample.iSeq,
+               trace_diff_ms(&sample.iStamp, &apply_end), trace_diff_ms(&sample.iStamp, &apply_start));
     }
     return nullptr;
 }
 
+// Parse a captured byte stream offline with the batch parser and report the result, returns the exit code
+int replay_capture(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        printf("Unable to open capture %s\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = (char*)malloc(file_size > 0 ? (size_t)file_size : 1);
+    if (data == nullptr || fread(data, 1, (size_t)file_size, file) != (size_t)file_size)
+    {
+        printf("Unable to read capture %s\n", path);
+        free(data);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    const size_t lines = batch_count_lines(data, (size_t)file_size);
+    struct batch_result result = {
+        .adc = (uint16_t*)malloc((lines + 1) * sizeof(uint16_t)),
+        .volume = (uint8_t*)malloc((lines + 1) * sizeof(uint8_t)),
+        .errors = (size_t*)malloc((lines + 1) * sizeof(size_t)),
+        .capacity = lines
+    };
+    int exit_code = 0;
+    if (result.adc == nullptr || result.volume == nullptr || result.errors == nullptr)
+    {
+        printf("Memory allocation failed\n");
+        exit_code = 1;
+    }
+    else
+    {
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        struct timespec start, end;
+        trace_now(&start);
+        const size_t consumed = batch_parse_parallel(data, (size_t)file_size, &result, cpus > 0 ? (unsigned int)cpus : 1);
+        trace_now(&end);
+        const double ms = trace_diff_ms(&start, &end);
+
+        printf("Replayed %s: %ld bytes, %zu samples, %zu invalid, %zu trailing bytes\n", path, file_size,
+               result.count, result.error_count, (size_t)file_size - consumed);
+        for (size_t i = 0; i < result.error_count && i < 10; i++)
+        {
+            printf("Invalid sample %zu\n", result.errors[i]);
+        }
+        // The newest valid sample is the volume the mixer would end up with, errors are sorted
+        size_t last = result.count;
+        size_t error = result.error_count;
+        while (last > 0 && error > 0 && result.errors[error - 1] == last - 1)
+        {
+            last--;
+            error--;
+        }
+        if (last > 0)
+        {
+            printf("Final volume %d (ADC %d)\n", result.volume[last - 1], result.adc[last - 1]);
+        }
+        printf("Parsed in %.3f ms (%.2f GB/s, %s, %ld threads)\n", ms,
+               ms > 0 ? (double)consumed / (ms * 1e6) : 0.0, batch_parse_isa(), cpus);
+    }
+    free(result.adc);
+    free(result.volume);
+    free(result.errors);
+    free(data);
+    return exit_code;
+}
+
+// Pin the mixer thread to a CPU, a negative cpu lets it run on any CPU of the process
+void apply_mixer_affinity(const int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu < 0)
+    {
+        sched_getaffinity(0, sizeof(set), &set);
+    }
+    else
+    {
+        CPU_SET(cpu, &set);
+    }
+    if (pthread_setaffinity_np(thread_amixer, sizeof(set), &set) != 0)
+    {
+        printf("Unable to pin mixer thread to CPU %d\n", cpu);
+    }
+}
+
+// Sink of the TX scheduler while the I/O engine is not attached
+int port_sink(const char* data, const size_t len)
+{
+    return port >= 0 && write(port, data, len) == (ssize_t)len ? 0 : 1;
+}
+
+// Sink of the TX scheduler through the I/O engine. While the main loop runs the bytes are only queued and the loop
+// submits everything queued in one iteration together with its read, otherwise every pump is submitted at once
+int serial_sink(const char* data, const size_t len)
+{
+    return serial_io_write(data, len) != 0 || (!tx_defer_flush && serial_io_flush() != 0);
+}
+
+// Pace the bytes sent to the device, at the line rate (8N1, 10 bits per byte) unless a rate is configured
+void apply_tx_pacing(const struct config* config)
+{
+    tx_configure(config->tx_rate != 0 ? config->tx_rate : (unsigned int)config->baud / 10, config->tx_budget);
+}
+
+// Hand the outputs of a configuration to the mixer thread, their levels start unknown and are all set again
+void apply_mixer_outputs(const struct config* config)
+{
+    pthread_mutex_lock(&config_mutex);
+    mixer_map_init(&mixer_outputs_next, config->mixer_control);
+    mixer_map_add_list(&mixer_outputs_next, config->mixer_outputs); // Validated when the config was read
+    mixer_outputs_generation++;
+    pthread_mutex_unlock(&config_mutex);
+}
+
+// Open or close the latency trace for a changed trace path
+void apply_trace(const char* path)
+{
+    trace_close();
+    if (path[0] == '\0')
+    {
+        return;
+    }
+    if (trace_open(path) != 0)
+    {
+        printf("Unable to open trace file %s, tracing disabled\n", path);
+    }
+    else
+    {
+        printf("Writing latency trace to %s\n", path);
+    }
+}
+
+// Make the read buffer large enough for the configured receive buffer, returns 0 on success
+int resize_buffer(const size_t size)
+{
+    if (size <= buffer_size)
+    {
+        return 0;
+    }
+    char* resized = (char*)realloc(buffer, size * sizeof(char));
+    if (resized == nullptr)
+    {
+        return 1;
+    }
+    buffer = resized;
+    buffer_size = size;
+    return 0;
+}
+
+// Reinitialize the port for a reloaded baud rate and timeout, returns 0 on success
+int reload_port(const int baud, const int vtime)
+{
+    return UART_Init(port, config_baud_speed(baud), vtime);
+}
+
+// Report a heap allocation made after warm-up
+void alloc_warn(const size_t size)
+{
+    printf("Heap allocation of %zu bytes in the steady state\n", size);
+}
+
+// Stop at a heap allocation made after warm-up, a core dump shows where it came from
+void alloc_abort(const size_t size)
+{
+    printf("Heap allocation of %zu bytes in the steady state, aborting\n", size);
+    fflush(stdout);
+    abort();
+}
+
+// Install the handling of steady-state allocations
+void apply_alloc_mode(const enum config_alloc_mode mode)
+{
+    alloc_set_hook(mode == CONFIG_ALLOC_ABORT ? alloc_abort : mode == CONFIG_ALLOC_WARN ? alloc_warn : nullptr);
+}
+
+// Rebuild the configuration after SIGHUP and apply everything that can change at runtime
+void reload_config(void)
+{
+    reload_requested = 0;
+    printf("Reloading configuration\n");
+    struct config next;
+    if (config_build(&next, &cfg_args) != 0)
+    {
+        printf("Config reload failed, keeping the current configuration\n");
+        return;
+    }
+    // Buffers are resized here, this is not the steady state
+    alloc_steady_end();
+
+    const struct config_apply apply = {reload_port, resize_buffer};
+    config_merge(&next, &cfg, &apply);
+    // A smaller buffer only stops further reads until the surplus is processed, the blocking policy drops nothing
+    queue_set_capacity(&buffer_queue, config_buffer_bytes(&next));
+    if (!queue_reserve(&buffer_queue, queue_capacity(&buffer_queue)))
+    {
+        printf("Memory allocation failed, the buffer queue will allocate while running\n");
+    }
+
+    if (handoff_configure(&volume_handoff, next.volume_queue, next.volume_policy, next.mixer_wait_ms) != 0)
+    {
+        printf("Memory allocation failed, the volume queue will allocate while running\n");
+    }
+
+    apply_tx_pacing(&next);
+    serial_io_set_coalesce(next.coalesce_us);
+    serial_io_set_wait_timeout((unsigned int)next.vtime * 100);
+    if (strcmp(next.trace, cfg.trace) != 0)
+    {
+        apply_trace(next.trace);
+    }
+    if (next.mixer_cpu != cfg.mixer_cpu)
+    {
+        apply_mixer_affinity(next.mixer_cpu);
+    }
+    if (strcmp(next.mixer_control, cfg.mixer_control) != 0 || strcmp(next.mixer_outputs, cfg.mixer_outputs) != 0)
+    {
+        apply_mixer_outputs(&next);
+    }
+    if (strcmp(next.mixer_control, cfg.mixer_control) != 0)
+    {
+        // Follow the new control and start from its current level
+        volume_watch_set_control(next.mixer_control);
+        volume_state_set_mixer(volume_state_read_mixer(next.mixer_control));
+    }
+
+    apply_alloc_mode(next.steady_alloc);
+
+    pthread_mutex_lock(&config_mutex);
+    cfg = next;
+    pthread_mutex_unlock(&config_mutex);
+    config_print(&cfg);
+    alloc_steady_begin();
+}
+
 char send_volume_handler(const int volume)
 {
-    static int last_volume = -1;
-    if (volume != last_volume)
+    if (volume != volume_state_device())
     {
         unsigned const int digits = count_digits(volume);
-        char buf[digits + 1];
+        char buf[5]; // Up to "100", the end byte and the terminating zero
         own_itoa(volume, buf);
-        if (write(port, buf, digits) != digits)
-        {
-            return 0;
-        }
-        if (write(port, "\n", 1) != 1)
+        buf[digits] = '\n'; // Number and its end byte go out as one message
+        // Sent by the scheduler, an echo still waiting for its turn is replaced
+        if (!tx_send(TX_PRIORITY_VOLUME, buf, digits + 1))
         {
             return 0;
         }
-        last_volume = volume;
+        volume_state_set_device(volume);
         return 2;
     }
     return 1;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     printf("BPC_SPC_Project\n");
     printf("Created by: Jan Lána, Martin Stieber; 2024\n\n\n\n");
 
+    // Defaults, config file and command line flags
+    const int args_result = config_parse_args(&cfg_args, argc, argv);
+    if (args_result != 0)
+    {
+        return args_result == 2 ? 0 : 1;
+    }
+    if (config_build(&cfg, &cfg_args) != 0)
+    {
+        printf("Invalid configuration, exiting\n");
+        return 1;
+    }
+    config_print(&cfg);
+
+    // Offline analysis of captured traffic, the device is not touched
+    if (cfg_args.replay_path != nullptr)
+    {
+        return replay_capture(cfg_args.replay_path);
+    }
+
     pthread_setname_np(pthread_self(), "BPC_SPC_Project");
     printf("Program started with thread id: %ld\n", pthread_self());
     // Set up signal handlers for cleanup on exit
     signal(SIGTERM, signal_exit_handler);
     signal(SIGINT, signal_exit_handler);
     signal(SIGQUIT, signal_exit_handler);
-    signal(SIGHUP, signal_exit_handler);
-    signal(SIGSEGV, signal_exit_handler);
-    signal(SIGFPE, signal_exit_handler);
+    signal(SIGHUP, signal_reload_handler);
+    // SIGSEGV and SIGFPE keep their default action, returning from a handler would repeat the fault
     signal(SIGKILL, signal_exit_handler);
     signal(SIGPIPE, signal_exit_handler);
 
 
     // Open the port
-    port = open(PORT, O_RDWR | O_NOCTTY);
+    port = open(cfg.device, O_RDWR | O_NOCTTY | O_CLOEXEC); // amixer children must not inherit the port
     if (port < 0)
     {
         printf("Unable to open port, is HW connected? Check it, and try again.\n");
-        signal_exit_handler(99);
+        exit_cleanup(99);
     }
     printf("Port open successfully\n");
 
     // Initialize UART
-    if (UART_Init(port) != 0)
+    if (UART_Init(port, config_baud_speed(cfg.baud), cfg.vtime) != 0)
     {
         printf("Unable to initialize UART\n");
-        signal_exit_handler(99);
+        exit_cleanup(99);
     }
 
-    // Handshake with the device
+    // Handshake with the device, written straight to the port until the I/O engine is attached
     constexpr char welcome = 'w';
+    tx_set_sink(port_sink);
+    apply_tx_pacing(&cfg);
     sleep(2);
     printf("Sending welcome byte now...\n");
-    write(port, &welcome, 1);
+    tx_send(TX_PRIORITY_CONTROL, &welcome, 1);
+    if (tx_finish(1000) != 0)
+    {
+        printf("Unable to send welcome byte\n");
+        exit_cleanup(99);
+    }
 
     char rec_byte = '0';
     const clock_t while_start = clock();
@@ -332,204 +655,255 @@ int main()
         if ((clock() - while_start) / CLOCKS_PER_SEC > 1)
         {
             printf("Timeout while waiting for welcome byte, exiting now (Is baud rate set OK?\n");
-            signal_exit_handler(99);
+            exit_cleanup(99);
         }
     }
     while (rec_byte != welcome);
     printf("Connection established, welcome byte OK\n\n");
 
     // Initialize the buffer queue
-    queue_init(&buffer_queue);
-    queue_init(&volume_queue);
+    queue_init_bounded(&buffer_queue, config_buffer_bytes(&cfg), BUFFER_QUEUE_POLICY);
+    // Nodes of both queues are allocated up front and recycled, pushing and popping never allocates
+    if (!queue_reserve(&buffer_queue, queue_capacity(&buffer_queue)) ||
+        handoff_init(&volume_handoff, cfg.volume_queue, cfg.volume_policy, cfg.mixer_wait_ms) != 0)
+    {
+        printf("Memory allocation failed\n");
+        exit_cleanup(99);
+    }
+
+    // Optional latency trace, viewable in chrome://tracing or Perfetto
+    apply_trace(cfg.trace);
+
+    // Live values for other local processes
+    if (cfg.telemetry[0] != '\0')
+    {
+        if (telemetry_open(cfg.telemetry) != 0)
+        {
+            printf("Unable to create telemetry segment %s, telemetry disabled\n", cfg.telemetry);
+        }
+        else
+        {
+            printf("Publishing telemetry in %s\n", cfg.telemetry);
+        }
+    }
+
+    // Attach the I/O engine
+    serial_io_init(port, cfg.io_uring);
+    serial_io_set_coalesce(cfg.coalesce_us);
+    serial_io_set_wait_timeout((unsigned int)cfg.vtime * 100);
+    tx_set_sink(serial_sink);
+    printf("Serial I/O backend: %s\n", serial_io_backend());
+    // External mixer changes and applies end the wait for the port, also without a wait timeout
+    volume_state_set_notify(serial_io_wake);
+
+    // Read buffer, never larger than the free space in buffer_queue
+    if (resize_buffer(config_buffer_bytes(&cfg)) != 0)
+    {
+        printf("Memory allocation failed\n");
+        exit_cleanup(99);
+    }
 
     unsigned int full_num_count = 0;
+    unsigned int sample_seq = 0;
 
+    apply_mixer_outputs(&cfg);
     pthread_create(&thread_amixer, nullptr, amixer_thread, NULL);
     thread_running = 1;
+    if (cfg.mixer_cpu >= 0)
+    {
+        apply_mixer_affinity(cfg.mixer_cpu);
+    }
 
-    // Main loop
-    while (running)
+    // Follow mixer changes made by other applications
+    if (volume_watch_start(cfg.mixer_control) != 0)
     {
-        int bytes_available = 0;
-        if (ioctl(port, FIONREAD, &bytes_available) == -1)
+        printf("Unable to follow mixer events, external volume changes will not reach the device\n");
+    }
+    printf("Mixer %s at %d\n", cfg.mixer_control, volume_state_mixer());
+
+    // Everything the loop needs is allocated, from here on the hot path must not touch the heap
+    apply_alloc_mode(cfg.steady_alloc);
+    alloc_steady_begin();
+
+    // Main loop, runs until an exit signal arrives or the mixer thread stops on an error
+    tx_defer_flush = 1;
+    while (running && atomic_load_explicit(&mixer_running, memory_order_relaxed))
+    {
+        if (reload_requested)
+        {
+            reload_config();
+        }
+
+        // Publish the applies of the mixer thread, the main loop is the only telemetry writer
+        int applied_volume;
+        struct timespec applied_at;
+        const unsigned long applied = volume_state_take_applied(&applied_volume, &applied_at);
+        if (applied != 0)
         {
-            printf(
-                "Error while checking bytes available, is HW still connected? Exiting now, calling signal_exit_handler with signum 99\n");
-            signal_exit_handler(99);
+            telemetry_begin();
+            telemetry_set(TELEMETRY_MIXER_VOLUME, (uint64_t)applied_volume);
+            telemetry_set(TELEMETRY_APPLIED_NS, telemetry_ns(&applied_at));
+            telemetry_add(TELEMETRY_APPLIED, applied);
+            telemetry_end();
         }
 
-        if ((bytes_available > 0) && (full_num_count < 50)) // Limit the number of numbers in the buffer
+        // Another application changed the mixer, show the new level on the device
+        int resync_volume;
+        if (volume_state_take_resync(&resync_volume))
         {
-            buffer = (char*)malloc(bytes_available * sizeof(char));
-            if (buffer == nullptr)
+            printf("Mixer at %d, resynchronizing device\n", resync_volume);
+            telemetry_begin();
+            telemetry_set(TELEMETRY_MIXER_VOLUME, (uint64_t)resync_volume);
+            telemetry_end();
+            if (send_volume_handler(resync_volume) == 0)
             {
-                printf("Memory allocation failed\n");
-                break;
+                printf("Error while sending volume (%d)\n", resync_volume);
             }
+        }
 
-            usleep(5000);
+        // Queue what the pacing allows of the waiting control bytes and volume echoes, the read below submits
+        // it to the engine in the same call
+        if (tx_pump() != 0)
+        {
+            printf("Error while sending to the device\n");
+        }
 
-            const int num_bytes = (int)read(port, buffer, bytes_available);
+        if (queue_is_full(&buffer_queue) && full_num_count == 0)
+        {
+            // No number end in a full buffer, the data can never be framed
+            printf("Buffer full without any complete number, flushing %zu bytes\n", queue_size(&buffer_queue));
+            while (queue_pop(&buffer_queue))
+            {
+            }
+        }
+
+        if (!queue_is_full(&buffer_queue)) // Limit the data held in the buffer
+        {
+            // Read no more than the buffer can take, the rest stays in the port.
+            // Block for data only when there is no complete number left to handle and nothing left to send.
+            const size_t buffer_space = queue_capacity(&buffer_queue) - queue_size(&buffer_queue);
+            struct timespec read_start;
+            trace_now(&read_start);
+            const int num_bytes = (int)serial_io_read(buffer, buffer_space, full_num_count == 0 && tx_idle());
             if (num_bytes < 0)
             {
-                printf("Error while reading bytes\n");
-                break;
+                printf(
+                    "Error while reading bytes, is HW still connected? Exiting now, calling exit_cleanup with code 99\n");
+                exit_cleanup(99);
             }
-            printf("Allocated %d bytes, Read %d bytes\n", bytes_available, num_bytes);
-            printf("Read: ");
-            for (int i = 0; i < num_bytes; i++)
+            if (num_bytes > 0)
             {
-                printf("%c", buffer[i]);
-                queue_push(&buffer_queue, buffer[i]);
-                if (buffer[i] == '\n')
-                    full_num_count++;
+                // All bytes of one read share its timestamp, a sample is stamped by its first byte
+                struct timespec read_stamp;
+                trace_now(&read_stamp);
+                trace_span("read", 0, &read_start, &read_stamp);
+                printf("Read %d bytes\n", num_bytes);
+                printf("Read: %.*s\n", num_bytes, buffer);
+                frame_feed(&buffer_queue, &full_num_count, buffer, (size_t)num_bytes, &read_stamp);
             }
-            free(buffer);
-            buffer = nullptr;
-            printf("\n");
+        }
+        else if (serial_io_flush() != 0) // No read this time, submit the queued bytes on their own
+        {
+            printf("Error while sending to the device\n");
         }
 
         // Handle complete numbers in the buffer
         if (full_num_count != 0)
         {
-            char* new_val = (char*)malloc(5 * sizeof(char));
-            if (new_val == nullptr)
+            char frame[FRAME_MAX_BYTES];
+            size_t frame_len = 0;
+            struct timespec sample_stamp = {0};
+            struct timespec frame_start;
+            trace_now(&frame_start);
+
+            // Read characters from the queue until a complete number is found
+            if (frame_take(&buffer_queue, &full_num_count, frame, &frame_len, &sample_stamp) == FRAME_RUNAWAY)
             {
-                printf("Memory allocation failed\n");
-                break;
+                printf("Number runaway\n");
+                telemetry_begin();
+                telemetry_add(TELEMETRY_RUNAWAYS, 1);
+                telemetry_end();
+                continue;
             }
 
-            unsigned char iter = 0;
-            char number_complete = 0;
+            const unsigned int seq = ++sample_seq;
+            struct timespec parse_start;
+            trace_now(&parse_start);
+            trace_span("frame", seq, &frame_start, &parse_start);
 
-            // Read characters from the queue until a complete number is found
-            while (!number_complete)
+            // Process the complete number
+            unsigned int adc_val = 0;
+            const enum frame_status status = frame_parse(frame, frame_len, &adc_val);
+            if (status == FRAME_OK)
             {
-                queue_front(&buffer_queue, &new_val[iter]);
-                queue_pop(&buffer_queue);
-                if (new_val[iter] == '\n')
+                const unsigned int volume = frame_volume(adc_val);
+
+                printf("Num OK\n");
+                struct timespec enqueue_start;
+                trace_now(&enqueue_start);
+                trace_span("parse", seq, &parse_start, &enqueue_start);
+                const TQueueElement sample = {.iData = (char)volume, .iSeq = seq, .iStamp = sample_stamp};
+                const bool queued = handoff_push(&volume_handoff, sample);
+                if (!queued)
                 {
-                    number_complete = 1;
-                    full_num_count--;
+                    printf("Volume queue full, volume dropped (%d)\n", volume);
                 }
-                iter++;
-                if (iter == 6)
+                telemetry_begin();
+                telemetry_set(TELEMETRY_ADC, adc_val);
+                telemetry_set(TELEMETRY_VOLUME, volume);
+                telemetry_set(TELEMETRY_SAMPLE_SEQ, seq);
+                telemetry_set(TELEMETRY_SAMPLE_NS, telemetry_ns(&sample_stamp));
+                telemetry_add(TELEMETRY_SAMPLES, 1);
+                telemetry_add(TELEMETRY_VOLUME_DROPS, queued ? 0 : 1);
+                telemetry_end();
+                struct timespec enqueue_end;
+                trace_now(&enqueue_end);
+                trace_span("enqueue", seq, &enqueue_start, &enqueue_end);
+
+                char send_volume_val = send_volume_handler(volume);
+
+                if (send_volume_val == 0)
                 {
-                    printf("Number runaway\n");
-                    while (queue_front(&buffer_queue, &new_val[iter]) == '\n')
-                    {
-                        queue_pop(&buffer_queue);
-                    }
-                    free(new_val);
-                    new_val = nullptr;
-                    break;
+                    printf("Error while sending volume (%d)\n", volume);
                 }
-            }
-
-            if (number_complete)
-            {
-                // Process the complete number
-                int pos = 0;
-                char is_buf_corrupted = 0;
-                while (new_val[pos] != '\n')
+                else if (send_volume_val == 1)
                 {
-                    pos++;
-                    if (pos == 5)
-                    {
-                        printf("Error while searching number's end byte, skipping iteration\n");
-                        is_buf_corrupted = 1;
-                        break;
-                    }
+                    printf("Volume already set (%d)\n", volume);
                 }
-
-                if (!is_buf_corrupted)
+                else
                 {
-                    char buf_b_p[pos + 1];
-
-                    for (int i = 0; i < pos; i++)
-                    {
-                        buf_b_p[i] = new_val[i];
-                    }
-
-                    buf_b_p[pos] = '\0';
-
-                    char is_num_corrupted = str_num_checker(buf_b_p);
-                    if (is_num_corrupted == -1)
-                    {
-                        printf("Pos of end byte changed, recalculating\n");
-                        pos = 0;
-                        while (buf_b_p[pos] != '\0')
-                        {
-                            pos++;
-                            if (pos == bytes_available)
-                            {
-                                printf("Error while searching number's end byte, skipping iteration\n");
-                                is_buf_corrupted = 1;
-                                break;
-                            }
-                        }
-                        is_num_corrupted = 0;
-                        if (pos == 0)
-                        {
-                            is_num_corrupted = 1;
-                        }
-                    }
-
-                    if (!is_num_corrupted)
-                    {
-                        unsigned int adc_val = (int)strtol(buf_b_p, nullptr, 10);
-
-                        unsigned int volume = (100 * adc_val) / 1024;
-
-                        if (adc_val > 1020)
-                        {
-                            volume = 100;
-                        }
-
-                        if (volume > 100)
-                        {
-                            volume = 100;
-                        }
-
-                        printf("Num OK\n");
-                        queue_push(&volume_queue, volume);
-
-                        char send_volume_val = send_volume_handler(volume);
-
-                        if (send_volume_val == 0)
-                        {
-                            printf("Error while sending volume (%d)\n", volume);
-                        }
-                        else if (send_volume_val == 1)
-                        {
-                            printf("Volume already set (%d)\n", volume);
-                        }
-                        else
-                        {
-                            printf("Volume set (%d)\n", volume);
-                        }
-                    }
-                    else
-                    {
-                        printf("Number corrupted, skipping\n");
-                    }
+                    printf("Volume set (%d)\n", volume);
+                }
+            }
+            else
+            {
+                if (status == FRAME_INVALID)
+                {
+                    printf("Number corrupted, skipping\n");
                 }
                 else
                 {
+                    printf("Error while searching number's end byte, skipping iteration\n");
                     printf("Buffer corrupted, skipping\n");
                 }
-                free(new_val);
-                new_val = nullptr;
-                printf("\n");
-                printf("-----------------------------------------");
-                printf("---------------------------------------\n");
-                printf("-----------------------------------------");
-                printf("---------------------------------------\n");
-                printf("\n");
+                telemetry_begin();
+                telemetry_add(TELEMETRY_INVALID, 1);
+                telemetry_end();
             }
+            printf("\n");
+            printf("-----------------------------------------");
+            printf("---------------------------------------\n");
+            printf("-----------------------------------------");
+            printf("---------------------------------------\n");
+            printf("\n");
         }
     }
 
-    signal_exit_handler(0); // Cleanup before exiting
+    // Cleanup before exiting, the mixer thread is joined here and not in the signal handler
+    if (!running)
+    {
+        printf("Caught signal %d\n", (int)exit_signal);
+    }
+    exit_cleanup(running ? -1 : exit_signal);
     return 0;
 }
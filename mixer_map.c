@@ -0,0 +1,240 @@
+#include "mixer_map.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "volume_state.h"
+
+static const char* mixer_curves[] = {
+    [MIXER_CURVE_LINEAR] = "linear",
+    [MIXER_CURVE_SQUARE] = "square",
+    [MIXER_CURVE_CUBE] = "cube",
+};
+
+static const char* mixer_map_statuses[] = {
+    [MIXER_MAP_OK] = "valid",
+    [MIXER_MAP_TOO_LONG] = "list too long",
+    [MIXER_MAP_MALFORMED] = "malformed entry",
+    [MIXER_MAP_TOO_MANY] = "too many outputs",
+    [MIXER_MAP_REPEATED] = "control repeated on the same card",
+};
+
+void mixer_map_init(struct mixer_map* map, const char* primary)
+{
+    memset(map, 0, sizeof(*map));
+    snprintf(map->outputs[0].control, sizeof(map->outputs[0].control), "%s", primary);
+    map->outputs[0].curve = MIXER_CURVE_LINEAR;
+    map->outputs[0].applied = VOLUME_UNKNOWN;
+    map->count = 1;
+}
+
+// Strip leading and trailing spaces in place
+static char* mixer_trim(char* text)
+{
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1]))
+    {
+        text[--len] = '\0';
+    }
+    return text;
+}
+
+// Parse one control[@card][:curve[:offset]] entry, returns 0 on success
+static int mixer_parse_output(char* entry, struct mixer_output* output)
+{
+    *output = (struct mixer_output){.curve = MIXER_CURVE_LINEAR, .applied = VOLUME_UNKNOWN};
+    char* curve = strchr(entry, ':');
+    char* offset = nullptr;
+    if (curve != nullptr)
+    {
+        *curve++ = '\0';
+        offset = strchr(curve, ':');
+        if (offset != nullptr)
+        {
+            *offset++ = '\0';
+        }
+    }
+    char* card = strchr(entry, '@');
+    if (card != nullptr)
+    {
+        *card++ = '\0';
+        card = mixer_trim(card);
+        if (card[0] == '\0' || strlen(card) >= sizeof(output->card) || strpbrk(card, "'\"") != nullptr)
+        {
+            return 1;
+        }
+        strcpy(output->card, card);
+    }
+    char* control = mixer_trim(entry);
+    if (control[0] == '\0' || strlen(control) >= sizeof(output->control) || strpbrk(control, "'\"") != nullptr)
+    {
+        return 1;
+    }
+    strcpy(output->control, control);
+    if (curve != nullptr)
+    {
+        curve = mixer_trim(curve);
+        size_t i = 0;
+        while (i < sizeof(mixer_curves) / sizeof(mixer_curves[0]) && strcmp(curve, mixer_curves[i]) != 0)
+        {
+            i++;
+        }
+        if (i == sizeof(mixer_curves) / sizeof(mixer_curves[0]))
+        {
+            return 1;
+        }
+        output->curve = (enum mixer_curve)i;
+    }
+    if (offset != nullptr)
+    {
+        offset = mixer_trim(offset);
+        char* end = nullptr;
+        const long parsed = strtol(offset, &end, 10);
+        if (end == offset || *end != '\0' || parsed < -100 || parsed > 100)
+        {
+            return 1;
+        }
+        output->offset = (int)parsed;
+    }
+    return 0;
+}
+
+enum mixer_map_status mixer_map_add_list(struct mixer_map* map, const char* list)
+{
+    char copy[MIXER_OUTPUTS_SIZE];
+    if (strlen(list) >= sizeof(copy))
+    {
+        return MIXER_MAP_TOO_LONG;
+    }
+    strcpy(copy, list);
+    if (mixer_trim(copy)[0] == '\0')
+    {
+        return MIXER_MAP_OK;
+    }
+    char* save = nullptr;
+    for (char* entry = strtok_r(copy, ",", &save); entry != nullptr; entry = strtok_r(nullptr, ",", &save))
+    {
+        if (map->count == MIXER_MAX_OUTPUTS)
+        {
+            return MIXER_MAP_TOO_MANY;
+        }
+        if (mixer_parse_output(entry, &map->outputs[map->count]) != 0)
+        {
+            return MIXER_MAP_MALFORMED;
+        }
+        // A control set twice with different levels would end up at whichever came last
+        const struct mixer_output* added = &map->outputs[map->count];
+        for (unsigned int i = 0; i < map->count; i++)
+        {
+            if (strcmp(map->outputs[i].control, added->control) == 0 && strcmp(map->outputs[i].card, added->card) == 0)
+            {
+                return MIXER_MAP_REPEATED;
+            }
+        }
+        map->count++;
+    }
+    return MIXER_MAP_OK;
+}
+
+const char* mixer_map_status_text(const enum mixer_map_status status)
+{
+    return mixer_map_statuses[status];
+}
+
+int mixer_output_level(const struct mixer_output* output, const int volume)
+{
+    int level = volume;
+    switch (output->curve)
+    {
+    case MIXER_CURVE_LINEAR:
+        break;
+    case MIXER_CURVE_SQUARE:
+        level = volume * volume / 100;
+        break;
+    case MIXER_CURVE_CUBE:
+        level = volume * volume * volume / 10000;
+        break;
+    }
+    level += output->offset;
+    return level < 0 ? 0 : level > 100 ? 100 : level;
+}
+
+unsigned int mixer_map_pending(const struct mixer_map* map, const int volume)
+{
+    unsigned int pending = 0;
+    for (unsigned int i = 0; i < map->count; i++)
+    {
+        pending += map->outputs[i].applied != mixer_output_level(&map->outputs[i], volume);
+    }
+    return pending;
+}
+
+unsigned int mixer_map_apply(struct mixer_map* map, const int volume)
+{
+    char command[64]; // "amixer -q -c '<card>' -s", the card is at most 31 characters
+    int levels[MIXER_MAX_OUTPUTS];
+    bool done[MIXER_MAX_OUTPUTS];
+    unsigned int group[MIXER_MAX_OUTPUTS]; // First output of the group an output was sent with
+    for (unsigned int i = 0; i < map->count; i++)
+    {
+        levels[i] = mixer_output_level(&map->outputs[i], volume);
+        done[i] = map->outputs[i].applied == levels[i];
+        group[i] = MIXER_MAX_OUTPUTS;
+    }
+
+    unsigned int failed = 0;
+    for (unsigned int first = 0; first < map->count; first++)
+    {
+        if (done[first])
+        {
+            continue;
+        }
+        // One process for every output on the card of the first pending one
+        const char* card = map->outputs[first].card;
+        if (card[0] != '\0')
+        {
+            snprintf(command, sizeof(command), "amixer -q -c '%s' -s", card);
+        }
+        else
+        {
+            snprintf(command, sizeof(command), "amixer -q -s");
+        }
+        FILE* amixer = popen(command, "w");
+        for (unsigned int i = first; i < map->count; i++)
+        {
+            if (!done[i] && strcmp(map->outputs[i].card, card) == 0)
+            {
+                if (amixer != nullptr)
+                {
+                    fprintf(amixer, "sset '%s' %d%%\n", map->outputs[i].control, levels[i]);
+                }
+                map->outputs[i].applied = levels[i];
+                done[i] = true;
+                group[i] = first;
+            }
+        }
+        if (amixer == nullptr || pclose(amixer) != 0)
+        {
+            // Which commands of the group took effect is not known
+            for (unsigned int i = first; i < map->count; i++)
+            {
+                if (group[i] == first)
+                {
+                    map->outputs[i].applied = VOLUME_UNKNOWN;
+                }
+            }
+            failed++;
+        }
+    }
+    return failed;
+}
+
+const char* mixer_curve_name(const enum mixer_curve curve)
+{
+    return mixer_curves[curve];
+}
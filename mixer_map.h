@@ -0,0 +1,73 @@
+#ifndef MIXER_MAP_H
+#define MIXER_MAP_H
+
+#include <stddef.h>
+
+// Fan-out of the knob volume to several mixer controls.
+// The first output is the primary control (mixer_control), set to the knob volume as is and followed for changes
+// made by other applications. Further outputs come from the mixer_outputs list, entries separated by commas:
+//   control[@card][:curve[:offset]]      e.g. "PCM:square, Headphone@1:linear:-10"
+// Each output maps the volume through its curve, adds its offset and clamps to 0..100. Outputs are grouped by
+// card and every group is applied by one "amixer -s" process reading all its commands from stdin, instead of
+// one process per control. Outputs already at their level are left out.
+
+#define MIXER_MAX_OUTPUTS 8 // Primary control included
+#define MIXER_OUTPUTS_SIZE 256 // Longest mixer_outputs value
+
+// Volume curve of an output, volume is in percent
+enum mixer_curve
+{
+    MIXER_CURVE_LINEAR, // volume
+    MIXER_CURVE_SQUARE, // volume^2 / 100, finer steps at low volume
+    MIXER_CURVE_CUBE, // volume^3 / 10000, closest to a perceptual taper
+};
+
+struct mixer_output
+{
+    char control[64]; // amixer simple control
+    char card[32]; // Card index or name, empty for the default card
+    enum mixer_curve curve;
+    int offset; // Added after the curve, in percent
+    int applied; // Level last set, VOLUME_UNKNOWN when not known
+};
+
+struct mixer_map
+{
+    struct mixer_output outputs[MIXER_MAX_OUTPUTS]; // outputs[0] is the primary control
+    unsigned int count;
+};
+
+// Start a map with only the primary control
+void mixer_map_init(struct mixer_map* map, const char* primary);
+
+// Result of mixer_map_add_list
+enum mixer_map_status
+{
+    MIXER_MAP_OK,
+    MIXER_MAP_TOO_LONG, // List longer than MIXER_OUTPUTS_SIZE - 1
+    MIXER_MAP_MALFORMED, // Entry that is not control[@card][:curve[:offset]]
+    MIXER_MAP_TOO_MANY, // More than MIXER_MAX_OUTPUTS outputs, primary control included
+    MIXER_MAP_REPEATED, // Control already in the map on the same card
+};
+
+// Append the outputs of a mixer_outputs list, returns MIXER_MAP_OK (0) on success. The map is left partly filled
+// on failure
+enum mixer_map_status mixer_map_add_list(struct mixer_map* map, const char* list);
+
+// Description of a mixer_map_add_list result for error messages
+const char* mixer_map_status_text(enum mixer_map_status status);
+
+// Level of one output for a knob volume
+int mixer_output_level(const struct mixer_output* output, int volume);
+
+// Number of outputs not yet at their level for a knob volume
+unsigned int mixer_map_pending(const struct mixer_map* map, int volume);
+
+// Set every output that is not at its level, one amixer process per card. Outputs of a failed group get an
+// unknown level. Returns the number of groups that failed
+unsigned int mixer_map_apply(struct mixer_map* map, int volume);
+
+// Name of a curve as used in mixer_outputs
+const char* mixer_curve_name(enum mixer_curve curve);
+
+#endif // MIXER_MAP_H
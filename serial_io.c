@@ -0,0 +1,661 @@
+#define _GNU_SOURCE
+#include "serial_io.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#ifdef SPC_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+static int io_fd = -1; // Port file descriptor
+static int io_uring_active = 0; // io_uring backend in use
+static struct serial_io_stats io_stats; // Syscall counters
+static unsigned int io_coalesce_us = 5000; // Plain backend, delay before a read
+static unsigned int io_wait_ms = 0; // Longest block of a waiting read, 0 for no limit
+static int wake_fd = -1; // eventfd that ends a waiting read, set before other threads can wake
+
+// Write the whole buffer with plain write calls, returns 0 on success and 1 on failure
+static int write_all(const char* data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t written = write(io_fd, data, len);
+        io_stats.syscalls++;
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return 1;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    io_stats.writes++;
+    return 0;
+}
+
+#ifdef SPC_HAVE_IO_URING
+
+#define SERIAL_IO_RING_ENTRIES 32 // Submission queue entries, enough for one read and every write slot
+#define SERIAL_IO_READ_BUFS 4 // Registered read buffers, one read is in flight at a time to keep the byte order
+#define SERIAL_IO_READ_SIZE 256 // Size of one read buffer
+#define SERIAL_IO_WRITE_SLOTS 16 // Outbound replies that can be in flight at once
+#define SERIAL_IO_WRITE_SIZE 16 // Size of one outbound slot, longer data takes several slots
+
+#define SERIAL_IO_TAG_READ (1ULL << 32) // user_data tag of read completions, low bits hold the buffer index
+#define SERIAL_IO_TAG_WRITE (2ULL << 32) // user_data tag of write completions, low bits hold the slot index
+#define SERIAL_IO_TAG_WAKE (3ULL << 32) // user_data tag of the wake eventfd read
+
+static int ring_fd = -1; // io_uring instance
+static void* sq_ring = MAP_FAILED; // Mapped submission ring
+static size_t sq_ring_size = 0;
+static void* cq_ring = MAP_FAILED; // Mapped completion ring, the same mapping as sq_ring with IORING_FEAT_SINGLE_MMAP
+static size_t cq_ring_size = 0;
+static struct io_uring_sqe* sqes = MAP_FAILED; // Mapped submission queue entries
+static size_t sqes_size = 0;
+
+static unsigned* sq_head;
+static unsigned* sq_tail;
+static unsigned* sq_mask;
+static unsigned* sq_array;
+static unsigned sq_entries;
+static unsigned* cq_head;
+static unsigned* cq_tail;
+static unsigned* cq_mask;
+static struct io_uring_cqe* cqes;
+
+static unsigned to_submit = 0; // Prepared entries not yet passed to the kernel
+static int fixed_buffers = 0; // Read buffers are registered, IORING_OP_READ_FIXED can be used
+static int wait_timeout = 0; // The kernel takes a timeout for waiting (IORING_FEAT_EXT_ARG)
+
+static char read_bufs[SERIAL_IO_READ_BUFS][SERIAL_IO_READ_SIZE];
+static size_t read_len[SERIAL_IO_READ_BUFS]; // Bytes received into each buffer
+static size_t read_off[SERIAL_IO_READ_BUFS]; // Bytes already handed out from each buffer
+static unsigned read_posted = 0; // Reads posted so far, read n uses buffer n % SERIAL_IO_READ_BUFS
+static unsigned read_completed = 0; // Reads completed with data
+static unsigned read_consumed = 0; // Completed reads handed out completely
+static int read_in_flight = 0;
+static int read_error = 0; // errno of a failed read, the port is gone
+
+static char write_bufs[SERIAL_IO_WRITE_SLOTS][SERIAL_IO_WRITE_SIZE];
+static size_t write_len[SERIAL_IO_WRITE_SLOTS];
+static int write_busy[SERIAL_IO_WRITE_SLOTS];
+static unsigned writes_in_flight = 0; // Prepared or submitted writes without a completion
+static struct io_uring_sqe* write_last = nullptr; // Last write of the chain being prepared
+static int write_error = 0;
+
+static uint64_t wake_count; // Target of the wake eventfd read
+static int wake_in_flight = 0;
+static int wake_pending = 0; // A wake completed outside of a wait, the next waiting read returns at once
+
+static int uring_enter(const unsigned min_complete)
+{
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    const void* argp = nullptr;
+    size_t argsz = 0;
+    if (min_complete && wait_timeout && io_wait_ms > 0)
+    {
+        // A tty read only completes once data arrives, VTIME does not apply to it
+        timeout = (struct __kernel_timespec){io_wait_ms / 1000, (io_wait_ms % 1000) * 1000000LL};
+        arg = (struct io_uring_getevents_arg){0, 0, 0, (__u64)(uintptr_t)&timeout};
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    const int ret = (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, argp, argsz);
+    io_stats.syscalls++;
+    if (ret < 0)
+    {
+        if (errno == ETIME)
+        {
+            // Timed out waiting, nothing was submitted (the call reports submissions over a timeout)
+            errno = EINTR;
+        }
+        return -1;
+    }
+    to_submit -= (unsigned)ret;
+    if (to_submit == 0)
+    {
+        // A submitted chain can not be extended any more
+        write_last = nullptr;
+    }
+    return 0;
+}
+
+// Take a free submission queue entry, the kernel only looks at it in io_uring_enter
+static struct io_uring_sqe* uring_get_sqe(void)
+{
+    const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    const unsigned tail = *sq_tail;
+    if (tail - head >= sq_entries)
+    {
+        return nullptr;
+    }
+    const unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+    return sqe;
+}
+
+// Post the next read unless one is already in flight or all buffers hold data
+static void uring_post_read(void)
+{
+    if (read_in_flight || read_error || read_posted - read_consumed >= SERIAL_IO_READ_BUFS)
+    {
+        return;
+    }
+    struct io_uring_sqe* sqe = uring_get_sqe();
+    if (sqe == nullptr)
+    {
+        return;
+    }
+    const unsigned index = read_posted % SERIAL_IO_READ_BUFS;
+    sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = io_fd;
+    sqe->addr = (unsigned long)read_bufs[index];
+    sqe->len = SERIAL_IO_READ_SIZE;
+    sqe->off = (__u64)-1; // Current file position, the port is a stream
+    sqe->buf_index = fixed_buffers ? index : 0;
+    sqe->user_data = SERIAL_IO_TAG_READ | index;
+    read_in_flight = 1;
+    read_posted++;
+}
+
+// Post a read of the wake eventfd, it completes and ends the wait when another thread calls serial_io_wake
+static void uring_post_wake(void)
+{
+    if (wake_in_flight || wake_fd < 0)
+    {
+        return;
+    }
+    struct io_uring_sqe* sqe = uring_get_sqe();
+    if (sqe == nullptr)
+    {
+        return;
+    }
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wake_fd;
+    sqe->addr = (unsigned long)&wake_count;
+    sqe->len = sizeof(wake_count);
+    sqe->user_data = SERIAL_IO_TAG_WAKE;
+    wake_in_flight = 1;
+}
+
+// Process all completions, this only touches the shared ring and does not enter the kernel
+static void uring_reap(void)
+{
+    unsigned head = *cq_head;
+    const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        const struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        const unsigned index = (unsigned)(cqe->user_data & 0xffffffffULL);
+        if (cqe->user_data == SERIAL_IO_TAG_WAKE)
+        {
+            wake_in_flight = 0;
+            if (cqe->res > 0)
+            {
+                wake_pending = 1;
+                io_stats.wakes++;
+            }
+        }
+        else if ((cqe->user_data & ~0xffffffffULL) == SERIAL_IO_TAG_READ)
+        {
+            read_in_flight = 0;
+            if (cqe->res > 0)
+            {
+                read_len[index] = (size_t)cqe->res;
+                read_off[index] = 0;
+                read_completed++;
+                io_stats.reads++;
+            }
+            else
+            {
+                // Nothing arrived before VTIME expired, the buffer is reused by the next read
+                read_posted--;
+                if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR)
+                {
+                    read_error = -cqe->res;
+                }
+            }
+        }
+        else
+        {
+            writes_in_flight--;
+            write_busy[index] = 0;
+            if (cqe->res == (int)write_len[index])
+            {
+                io_stats.writes++;
+            }
+            else
+            {
+                // Short write or a link broken by one, finish this slot synchronously
+                const size_t done = cqe->res > 0 ? (size_t)cqe->res : 0;
+                if (write_all(write_bufs[index] + done, write_len[index] - done) != 0)
+                {
+                    write_error = 1;
+                }
+            }
+        }
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Wait until every write submitted so far has completed
+static int uring_drain_writes(void)
+{
+    while (writes_in_flight > 0)
+    {
+        if (uring_enter(1) != 0 && errno != EINTR)
+        {
+            return 1;
+        }
+        uring_reap();
+    }
+    return 0;
+}
+
+static void uring_teardown(void)
+{
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqes_size);
+        sqes = MAP_FAILED;
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+    {
+        munmap(cq_ring, cq_ring_size);
+    }
+    cq_ring = MAP_FAILED;
+    if (sq_ring != MAP_FAILED)
+    {
+        munmap(sq_ring, sq_ring_size);
+        sq_ring = MAP_FAILED;
+    }
+    if (ring_fd >= 0)
+    {
+        close(ring_fd);
+        ring_fd = -1;
+    }
+}
+
+static int uring_setup(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = (int)syscall(__NR_io_uring_setup, SERIAL_IO_RING_ENTRIES, &params);
+    if (ring_fd < 0)
+    {
+        return 1;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    const int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    wait_timeout = (params.features & IORING_FEAT_EXT_ARG) != 0;
+    if (single_mmap && cq_ring_size > sq_ring_size)
+    {
+        sq_ring_size = cq_ring_size;
+    }
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                   IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        uring_teardown();
+        return 1;
+    }
+    cq_ring = single_mmap
+                  ? sq_ring
+                  : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                         IORING_OFF_CQ_RING);
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (cq_ring == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        uring_teardown();
+        return 1;
+    }
+
+    sq_head = (unsigned*)((char*)sq_ring + params.sq_off.head);
+    sq_tail = (unsigned*)((char*)sq_ring + params.sq_off.tail);
+    sq_mask = (unsigned*)((char*)sq_ring + params.sq_off.ring_mask);
+    sq_array = (unsigned*)((char*)sq_ring + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    cq_head = (unsigned*)((char*)cq_ring + params.cq_off.head);
+    cq_tail = (unsigned*)((char*)cq_ring + params.cq_off.tail);
+    cq_mask = (unsigned*)((char*)cq_ring + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cq_ring + params.cq_off.cqes);
+
+    // Registered buffers save the page pinning on every read, plain reads still work without them
+    struct iovec iov[SERIAL_IO_READ_BUFS];
+    for (int i = 0; i < SERIAL_IO_READ_BUFS; i++)
+    {
+        iov[i].iov_base = read_bufs[i];
+        iov[i].iov_len = SERIAL_IO_READ_SIZE;
+    }
+    fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iov, SERIAL_IO_READ_BUFS) == 0;
+
+    to_submit = 0;
+    read_posted = read_completed = read_consumed = 0;
+    read_in_flight = read_error = 0;
+    writes_in_flight = 0;
+    write_last = nullptr;
+    write_error = 0;
+    wake_in_flight = wake_pending = 0;
+    memset(write_busy, 0, sizeof(write_busy));
+    return 0;
+}
+
+static ssize_t uring_read(char* dst, const size_t cap, const int wait)
+{
+    uring_reap();
+    uring_post_read();
+    const int block = wait && !wake_pending && read_consumed == read_completed;
+    if (block)
+    {
+        uring_post_wake();
+    }
+    if (to_submit > 0 || block)
+    {
+        if (uring_enter(block ? 1 : 0) != 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        uring_reap();
+    }
+    if (wait)
+    {
+        wake_pending = 0;
+    }
+    if (read_error && read_consumed == read_completed)
+    {
+        errno = read_error;
+        return -1;
+    }
+
+    size_t copied = 0;
+    while (copied < cap && read_consumed != read_completed)
+    {
+        const unsigned index = read_consumed % SERIAL_IO_READ_BUFS;
+        size_t n = read_len[index] - read_off[index];
+        if (n > cap - copied)
+        {
+            n = cap - copied;
+        }
+        memcpy(dst + copied, read_bufs[index] + read_off[index], n);
+        read_off[index] += n;
+        copied += n;
+        if (read_off[index] == read_len[index])
+        {
+            read_consumed++;
+        }
+    }
+    return (ssize_t)copied;
+}
+
+static int uring_write(const char* data, size_t len)
+{
+    // A write of an earlier chain failed, it is reported by the next write or flush
+    if (write_error)
+    {
+        write_error = 0;
+        return 1;
+    }
+    // A new chain may only start once the previous one is done, chains are not ordered against each other
+    if (write_last == nullptr && uring_drain_writes() != 0)
+    {
+        return 1;
+    }
+    while (len > 0)
+    {
+        int slot = -1;
+        for (int i = 0; i < SERIAL_IO_WRITE_SLOTS && slot < 0; i++)
+        {
+            if (!write_busy[i])
+            {
+                slot = i;
+            }
+        }
+        struct io_uring_sqe* sqe = slot < 0 ? nullptr : uring_get_sqe();
+        if (sqe == nullptr)
+        {
+            // Out of slots or entries, send what is prepared and continue with a new chain
+            if (uring_enter(0) != 0 || uring_drain_writes() != 0)
+            {
+                return 1;
+            }
+            continue;
+        }
+        const size_t n = len < SERIAL_IO_WRITE_SIZE ? len : SERIAL_IO_WRITE_SIZE;
+        memcpy(write_bufs[slot], data, n);
+        write_len[slot] = n;
+        write_busy[slot] = 1;
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = io_fd;
+        sqe->addr = (unsigned long)write_bufs[slot];
+        sqe->len = (unsigned)n;
+        sqe->off = (__u64)-1;
+        sqe->user_data = SERIAL_IO_TAG_WRITE | (unsigned)slot;
+        if (write_last != nullptr)
+        {
+            write_last->flags |= IOSQE_IO_LINK;
+            // A linked write started from task work sees the task work's notification as a pending signal, and the
+            // tty fails it with EINTR. Run it in an io-wq worker, the head of the chain is still written inline
+            sqe->flags |= IOSQE_ASYNC;
+        }
+        write_last = sqe;
+        writes_in_flight++;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int uring_flush(void)
+{
+    if (to_submit > 0)
+    {
+        // The next read, if one is due, goes to the kernel in the same call
+        uring_reap();
+        uring_post_read();
+        if (uring_enter(0) != 0)
+        {
+            return 1;
+        }
+    }
+    uring_reap();
+    if (write_error)
+    {
+        write_error = 0;
+        return 1;
+    }
+    return 0;
+}
+
+#endif // SPC_HAVE_IO_URING
+
+int serial_io_init(const int fd, const int use_uring)
+{
+    if (fd < 0)
+    {
+        return 1;
+    }
+    io_fd = fd;
+    io_uring_active = 0;
+    memset(&io_stats, 0, sizeof(io_stats));
+    // Blocking, so that io_uring waits for it like for the port instead of failing with EAGAIN
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        printf("Unable to create the wake eventfd (%s), waiting reads end only on their timeout\n", strerror(errno));
+    }
+    if (use_uring)
+    {
+#ifdef SPC_HAVE_IO_URING
+        if (uring_setup() == 0)
+        {
+            io_uring_active = 1;
+        }
+        else
+        {
+            printf("io_uring unavailable (%s), falling back to plain read/write\n", strerror(errno));
+        }
+#else
+        printf("Built without io_uring support, using plain read/write\n");
+#endif
+    }
+    return 0;
+}
+
+void serial_io_set_coalesce(const unsigned int coalesce_us)
+{
+    io_coalesce_us = coalesce_us;
+}
+
+void serial_io_set_wait_timeout(const unsigned int wait_ms)
+{
+    io_wait_ms = wait_ms;
+}
+
+void serial_io_wake(void)
+{
+    // Only fails when the counter would overflow, a wake is pending then anyway
+    const uint64_t one = 1;
+    if (wake_fd >= 0)
+    {
+        const ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+const char* serial_io_backend(void)
+{
+    return io_uring_active ? "io_uring" : "read/write";
+}
+
+ssize_t serial_io_read(char* dst, const size_t cap, const int wait)
+{
+    if (io_fd < 0 || cap == 0)
+    {
+        return io_fd < 0 ? -1 : 0;
+    }
+#ifdef SPC_HAVE_IO_URING
+    if (io_uring_active)
+    {
+        return uring_read(dst, cap, wait);
+    }
+#endif
+    int bytes_available = 0;
+    io_stats.syscalls++;
+    if (ioctl(io_fd, FIONREAD, &bytes_available) == -1)
+    {
+        return -1;
+    }
+    if (bytes_available <= 0 && wait)
+    {
+        // VMIN is 0, so only poll blocks. A signal, serial_io_wake or the timeout ends the wait with nothing read
+        struct pollfd ready[2] = {{.fd = io_fd, .events = POLLIN}, {.fd = wake_fd, .events = POLLIN}};
+        io_stats.syscalls++;
+        if (poll(ready, wake_fd >= 0 ? 2 : 1, io_wait_ms > 0 ? (int)io_wait_ms : -1) < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        if (wake_fd >= 0 && (ready[1].revents & POLLIN))
+        {
+            uint64_t count;
+            io_stats.syscalls++;
+            io_stats.wakes += read(wake_fd, &count, sizeof(count)) == sizeof(count);
+        }
+        io_stats.syscalls++;
+        if (ioctl(io_fd, FIONREAD, &bytes_available) == -1)
+        {
+            return -1;
+        }
+    }
+    if (bytes_available <= 0)
+    {
+        return 0;
+    }
+    if ((size_t)bytes_available > cap)
+    {
+        bytes_available = (int)cap;
+    }
+    if (io_coalesce_us > 0)
+    {
+        usleep(io_coalesce_us);
+    }
+    const ssize_t num_bytes = read(io_fd, dst, bytes_available);
+    io_stats.syscalls++;
+    if (num_bytes > 0)
+    {
+        io_stats.reads++;
+    }
+    return num_bytes;
+}
+
+int serial_io_write(const char* data, const size_t len)
+{
+    if (io_fd < 0)
+    {
+        return 1;
+    }
+#ifdef SPC_HAVE_IO_URING
+    if (io_uring_active)
+    {
+        return uring_write(data, len);
+    }
+#endif
+    return write_all(data, len);
+}
+
+int serial_io_flush(void)
+{
+#ifdef SPC_HAVE_IO_URING
+    if (io_uring_active)
+    {
+        return uring_flush();
+    }
+#endif
+    return 0;
+}
+
+struct serial_io_stats serial_io_get_stats(void)
+{
+    return io_stats;
+}
+
+void serial_io_close(void)
+{
+#ifdef SPC_HAVE_IO_URING
+    if (io_uring_active)
+    {
+        // The reads still in flight, of the port and of the wake eventfd, are cancelled when the ring is closed
+        uring_flush();
+        uring_drain_writes();
+        uring_teardown();
+        io_uring_active = 0;
+    }
+#endif
+    if (wake_fd >= 0)
+    {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    io_fd = -1;
+}
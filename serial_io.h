@@ -0,0 +1,61 @@
+#ifndef SERIAL_IO_H
+#define SERIAL_IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Serial port I/O engine.
+// With io_uring a read into one of a small ring of registered buffers is always posted, completions are
+// picked up from the shared completion ring without a syscall, and replies queued by serial_io_write are
+// submitted as one chain of linked writes together with the next read. When io_uring cannot be set up
+// (old kernel, seccomp, built without SPC_HAVE_IO_URING) plain ioctl(FIONREAD)/read/write calls are used, and a
+// waiting read blocks in poll().
+
+// Syscall counters, used to compare the backends
+struct serial_io_stats
+{
+    unsigned long syscalls; // Syscalls issued by the engine
+    unsigned long reads; // Completed reads that returned data
+    unsigned long writes; // Completed writes
+    unsigned long wakes; // Waits ended by serial_io_wake
+};
+
+// Attach the engine to an opened and initialized port, use_uring selects io_uring if it is available.
+// Returns 0 on success and 1 on failure
+int serial_io_init(int fd, int use_uring);
+
+// Delay of the plain backend before a read, lets more bytes arrive so that they are read at once
+void serial_io_set_coalesce(unsigned int coalesce_us);
+
+// Longest block of a waiting read, 0 for no limit. VTIME of the port does not apply, on either backend a read only
+// waits when there is nothing to take. Kernels without IORING_FEAT_EXT_ARG wait without a limit on the io_uring
+// backend, serial_io_wake and signals still end the wait
+void serial_io_set_wait_timeout(unsigned int wait_ms);
+
+// End the wait of a blocked serial_io_read, which returns what it has so far, possibly 0. Without a waiting read
+// the next one returns at once. Called from other threads when the main loop has work that is not on the port,
+// async-signal-safe
+void serial_io_wake(void);
+
+// Name of the active backend
+const char* serial_io_backend(void);
+
+// Copy up to cap received bytes into dst. With wait set the call may block until data arrives.
+// Returns the number of bytes copied, 0 when nothing was received and -1 on a port error
+ssize_t serial_io_read(char* dst, size_t cap, int wait);
+
+// Queue len bytes for the device. With io_uring they are submitted in order by the next serial_io_read or
+// serial_io_flush, so writes queued in between go out as one linked chain. Returns 0 on success and 1 on failure,
+// including a failure of an earlier chain
+int serial_io_write(const char* data, size_t len);
+
+// Send all queued bytes, returns 0 on success and 1 on failure
+int serial_io_flush(void);
+
+// Current syscall counters
+struct serial_io_stats serial_io_get_stats(void);
+
+// Wait for queued writes, detach from the port and release the io_uring instance (the port stays open)
+void serial_io_close(void);
+
+#endif // SERIAL_IO_H
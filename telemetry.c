@@ -0,0 +1,160 @@
+#include "telemetry.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static struct telemetry_segment* segment = nullptr; // Mapped segment, nullptr when not publishing
+static char segment_name[256]; // Name to unlink on close
+static dev_t segment_dev; // Identity of the created object, the name is only unlinked while it still refers to it
+static ino_t segment_ino;
+
+// Check an existing object of that name, returns 1 when it is a segment left behind by a process that is gone
+static int telemetry_is_stale(const char* name)
+{
+    const int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return errno == ENOENT; // Unlinked meanwhile
+    }
+    struct stat st;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct telemetry_segment))
+    {
+        mapped = mmap(nullptr, sizeof(struct telemetry_segment), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return 0;
+    }
+    // Another program's object is left alone, ours is stale once closed or once its publisher is gone
+    const struct telemetry_segment* existing = mapped;
+    const int stale = existing->magic == TELEMETRY_MAGIC &&
+        (!atomic_load_explicit(&existing->open, memory_order_acquire) ||
+            (kill(existing->pid, 0) != 0 && errno == ESRCH));
+    munmap(mapped, sizeof(struct telemetry_segment));
+    return stale;
+}
+
+int telemetry_open(const char* name)
+{
+    if (segment != nullptr || strlen(name) >= sizeof(segment_name))
+    {
+        return 1;
+    }
+    // Never attach to an object another instance created, so closing only ever unlinks our own
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 && errno == EEXIST && telemetry_is_stale(name))
+    {
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd < 0)
+    {
+        return 1;
+    }
+    struct stat st;
+    if (ftruncate(fd, sizeof(struct telemetry_segment)) != 0 || fstat(fd, &st) != 0)
+    {
+        close(fd);
+        shm_unlink(name);
+        return 1;
+    }
+    void* mapped = mmap(nullptr, sizeof(struct telemetry_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return 1;
+    }
+    // A new object is zero filled, the magic is written last
+    struct telemetry_segment* fresh = mapped;
+    fresh->version = TELEMETRY_VERSION;
+    fresh->field_count = TELEMETRY_FIELD_COUNT;
+    fresh->pid = getpid();
+    fresh->magic = TELEMETRY_MAGIC;
+    atomic_store_explicit(&fresh->open, 1, memory_order_release);
+    strcpy(segment_name, name);
+    segment_dev = st.st_dev;
+    segment_ino = st.st_ino;
+    segment = fresh;
+    return 0;
+}
+
+int telemetry_is_open(void)
+{
+    return segment != nullptr;
+}
+
+void telemetry_close(void)
+{
+    if (segment == nullptr)
+    {
+        return;
+    }
+    atomic_store_explicit(&segment->open, 0, memory_order_release);
+    munmap(segment, sizeof(struct telemetry_segment));
+    segment = nullptr;
+    // A later instance may have taken the name over after deciding this one was gone
+    const int fd = shm_open(segment_name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat st;
+    const int ours = fstat(fd, &st) == 0 && st.st_dev == segment_dev && st.st_ino == segment_ino;
+    close(fd);
+    if (ours)
+    {
+        shm_unlink(segment_name);
+    }
+}
+
+void telemetry_begin(void)
+{
+    if (segment == nullptr)
+    {
+        return;
+    }
+    // Take the sequence from even to odd, there is one writer so a plain store does
+    const unsigned int sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+    atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_relaxed);
+    // The odd sequence must be visible before any of the values
+    atomic_thread_fence(memory_order_release);
+}
+
+void telemetry_set(const enum telemetry_field field, const uint64_t value)
+{
+    if (segment != nullptr)
+    {
+        atomic_store_explicit(&segment->values[field], value, memory_order_relaxed);
+    }
+}
+
+void telemetry_add(const enum telemetry_field field, const uint64_t delta)
+{
+    if (segment != nullptr)
+    {
+        // Only the one writer changes the value, no read-modify-write needed
+        const uint64_t value = atomic_load_explicit(&segment->values[field], memory_order_relaxed);
+        atomic_store_explicit(&segment->values[field], value + delta, memory_order_relaxed);
+    }
+}
+
+void telemetry_end(void)
+{
+    if (segment != nullptr)
+    {
+        const unsigned int sequence = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+        atomic_store_explicit(&segment->sequence, sequence + 1, memory_order_release);
+    }
+}
+
+uint64_t telemetry_ns(const struct timespec* ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000u + (uint64_t)ts->tv_nsec;
+}
@@ -0,0 +1,75 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+// Live telemetry in shared memory.
+// The program publishes the latest ADC value, volume, timestamps and counters into a POSIX shared memory object
+// (shm_open + mmap). Updates are guarded by a seqlock: a writer makes the sequence odd, stores the values and
+// makes it even again, a reader copies the values and retries when the sequence changed meanwhile. Neither side
+// takes a lock or makes a syscall, so any number of readers can watch without slowing the ingest loop. There is
+// one writer, the main loop, other threads hand their values to it (see volume_state_take_applied).
+// Readers use the spc_telemetry library (telemetry_reader.h).
+
+#define TELEMETRY_DEFAULT_NAME "/spc_telemetry" // Shared memory object name
+#define TELEMETRY_MAGIC 0x54435053u // "SPCT"
+#define TELEMETRY_VERSION 1u // Bumped whenever the layout changes
+
+// Published values, timestamps are CLOCK_MONOTONIC nanoseconds
+enum telemetry_field
+{
+    TELEMETRY_ADC, // Latest valid ADC reading
+    TELEMETRY_VOLUME, // Volume computed from it, in percent
+    TELEMETRY_SAMPLE_SEQ, // Number of the latest sample
+    TELEMETRY_SAMPLE_NS, // When the bytes of the latest sample were read
+    TELEMETRY_MIXER_VOLUME, // Volume the mixer was last set to
+    TELEMETRY_APPLIED_NS, // When the mixer was last set
+    TELEMETRY_SAMPLES, // Valid samples parsed
+    TELEMETRY_INVALID, // Frames that were not a valid number
+    TELEMETRY_RUNAWAYS, // Bytes dropped for a missing end byte, in frames
+    TELEMETRY_VOLUME_DROPS, // Volumes lost to a full volume queue
+    TELEMETRY_APPLIED, // Volumes set on the mixer
+    TELEMETRY_FIELD_COUNT
+};
+
+// Layout of the shared memory object
+struct telemetry_segment
+{
+    uint32_t magic; // TELEMETRY_MAGIC once the segment is initialized
+    uint32_t version; // TELEMETRY_VERSION of the writer
+    uint32_t field_count; // TELEMETRY_FIELD_COUNT of the writer
+    int32_t pid; // Publishing process
+    atomic_uint open; // Cleared when the publisher closes the segment, readers should reopen
+    atomic_uint sequence; // Seqlock sequence, odd while a write is in progress
+    _Atomic uint64_t values[TELEMETRY_FIELD_COUNT]; // Indexed by enum telemetry_field
+};
+
+// Create the shared memory object and map it, returns 0 on success and 1 on failure. Fails while another running
+// instance publishes under the name or when the name belongs to something else, a segment left behind by a
+// crashed run is replaced
+int telemetry_open(const char* name);
+
+// Check whether telemetry is being published
+int telemetry_is_open(void);
+
+// Mark the segment closed, unmap it and unlink the name unless it was replaced meanwhile
+void telemetry_close(void);
+
+// Start an update, values set until telemetry_end are seen by readers together. Only from the writer thread
+void telemetry_begin(void);
+
+// Set one value, only between telemetry_begin and telemetry_end
+void telemetry_set(enum telemetry_field field, uint64_t value);
+
+// Add to one counter, only between telemetry_begin and telemetry_end
+void telemetry_add(enum telemetry_field field, uint64_t delta);
+
+// Publish the update
+void telemetry_end(void);
+
+// Timestamp in the unit of the *_NS fields
+uint64_t telemetry_ns(const struct timespec* ts);
+
+#endif // TELEMETRY_H
@@ -0,0 +1,106 @@
+#include "telemetry_reader.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TELEMETRY_READ_SPINS 256 // Attempts before a read yields to a writer that is slow to finish
+#define TELEMETRY_READ_TRIES 4096 // Attempts before a read gives up on a writer stuck mid-update
+
+int telemetry_reader_open(struct telemetry_reader* reader, const char* name)
+{
+    reader->segment = nullptr;
+    const int fd = shm_open(name != nullptr ? name : TELEMETRY_DEFAULT_NAME, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct telemetry_segment))
+    {
+        close(fd);
+        return 1;
+    }
+    void* mapped = mmap(nullptr, sizeof(struct telemetry_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return 1;
+    }
+    const struct telemetry_segment* segment = mapped;
+    if (!atomic_load_explicit(&segment->open, memory_order_acquire) || segment->magic != TELEMETRY_MAGIC ||
+        segment->version != TELEMETRY_VERSION || segment->field_count != TELEMETRY_FIELD_COUNT)
+    {
+        munmap(mapped, sizeof(struct telemetry_segment));
+        return 1;
+    }
+    reader->segment = segment;
+    return 0;
+}
+
+bool telemetry_reader_read(const struct telemetry_reader* reader, struct telemetry_snapshot* snapshot)
+{
+    const struct telemetry_segment* segment = reader->segment;
+    if (segment == nullptr || !atomic_load_explicit(&segment->open, memory_order_acquire))
+    {
+        return false;
+    }
+    for (int attempt = 0; attempt < TELEMETRY_READ_TRIES; attempt++)
+    {
+        // A writer preempted in the middle of an update holds everyone up, let it run
+        if (attempt >= TELEMETRY_READ_SPINS)
+        {
+            sched_yield();
+        }
+        const unsigned int before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < TELEMETRY_FIELD_COUNT; i++)
+        {
+            snapshot->values[i] = atomic_load_explicit(&segment->values[i], memory_order_relaxed);
+        }
+        // The values must be loaded before the sequence is checked again
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&segment->sequence, memory_order_relaxed) == before)
+        {
+            snapshot->sequence = before;
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int telemetry_reader_sequence(const struct telemetry_reader* reader)
+{
+    return reader->segment != nullptr ? atomic_load_explicit(&reader->segment->sequence, memory_order_acquire) : 0;
+}
+
+const char* telemetry_field_name(const enum telemetry_field field)
+{
+    static const char* names[TELEMETRY_FIELD_COUNT] = {
+        [TELEMETRY_ADC] = "adc",
+        [TELEMETRY_VOLUME] = "volume",
+        [TELEMETRY_SAMPLE_SEQ] = "sample_seq",
+        [TELEMETRY_SAMPLE_NS] = "sample_ns",
+        [TELEMETRY_MIXER_VOLUME] = "mixer_volume",
+        [TELEMETRY_APPLIED_NS] = "applied_ns",
+        [TELEMETRY_SAMPLES] = "samples",
+        [TELEMETRY_INVALID] = "invalid",
+        [TELEMETRY_RUNAWAYS] = "runaways",
+        [TELEMETRY_VOLUME_DROPS] = "volume_drops",
+        [TELEMETRY_APPLIED] = "applied",
+    };
+    return field >= 0 && field < TELEMETRY_FIELD_COUNT ? names[field] : "unknown";
+}
+
+void telemetry_reader_close(struct telemetry_reader* reader)
+{
+    if (reader->segment != nullptr)
+    {
+        munmap((void*)reader->segment, sizeof(struct telemetry_segment));
+        reader->segment = nullptr;
+    }
+}
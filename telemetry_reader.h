@@ -0,0 +1,43 @@
+#ifndef TELEMETRY_READER_H
+#define TELEMETRY_READER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "telemetry.h"
+
+// Reader side of the shared memory telemetry, built as the spc_telemetry static library.
+// Opening maps the segment once, after that reads are plain loads from the mapping without any syscall (unless
+// a writer is preempted in the middle of an update, then the reader yields), so a consumer can poll as often as
+// it likes. When telemetry_reader_read reports the publisher gone, close the reader and open it again once the
+// program is back.
+
+struct telemetry_reader
+{
+    const struct telemetry_segment* segment; // Mapped segment, nullptr when not open
+};
+
+// Consistent copy of all values
+struct telemetry_snapshot
+{
+    unsigned int sequence; // Seqlock sequence of the copy, changes with every update
+    uint64_t values[TELEMETRY_FIELD_COUNT]; // Indexed by enum telemetry_field
+};
+
+// Map the segment of a running publisher, nullptr name for TELEMETRY_DEFAULT_NAME. Returns 0 on success and 1
+// when there is no segment or its layout does not match this library
+int telemetry_reader_open(struct telemetry_reader* reader, const char* name);
+
+// Copy the latest values, returns false when the publisher has closed the segment or stayed in the middle of
+// an update for too long
+bool telemetry_reader_read(const struct telemetry_reader* reader, struct telemetry_snapshot* snapshot);
+
+// Current sequence, a cheap check whether anything changed since the last snapshot
+unsigned int telemetry_reader_sequence(const struct telemetry_reader* reader);
+
+// Name of a field, for printing
+const char* telemetry_field_name(enum telemetry_field field);
+
+// Unmap the segment
+void telemetry_reader_close(struct telemetry_reader* reader);
+
+#endif // TELEMETRY_READER_H
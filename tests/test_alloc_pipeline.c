@@ -0,0 +1,212 @@
+// Program-level allocation test of the per-sample path.
+// After a warm-up round the bytes are fed, framed, parsed and handed to a consumer thread for a while with the
+// heap accounting in the steady state, going through everything main.c does per sample: telemetry updates, the
+// volume echo through the TX scheduler, the volume state hand-over in both directions and the pending-output check
+// of the mixer map (the consumer stands in for the mixer thread, without spawning amixer). A single malloc in that
+// code fails the test. Needs the counting wrappers, so it is built with SPC_ALLOC_STATS and the --wrap link
+// options, which do not see allocations inside libc.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include "../alloc_stats.h"
+#include "../config.h"
+#include "../frame.h"
+#include "../handoff.h"
+#include "../mixer_map.h"
+#include "../telemetry.h"
+#include "../tx_sched.h"
+#include "../volume_state.h"
+#include "test_util.h"
+
+#define BUFFER_NUMBERS 50 // Receive buffer of the default configuration
+#define READ_MAX 64 // Largest single read
+
+static atomic_size_t first_size; // Size of the first steady-state allocation, +1 so that 0 means none
+static unsigned long echoed; // Bytes the TX scheduler handed to the sink
+static atomic_ulong applies; // Volumes the consumer applied
+
+static void on_steady_alloc(const size_t size)
+{
+    size_t none = 0;
+    atomic_compare_exchange_strong(&first_size, &none, size + 1);
+}
+
+// Takes the volume echoes instead of the port
+static int count_sink(const char* data, const size_t len)
+{
+    (void)data;
+    echoed += len;
+    return 0;
+}
+
+// Does what the mixer thread does with a sample, setting the levels instead of running amixer
+static void* consume(void* arg)
+{
+    struct handoff* handoff = arg;
+    struct mixer_map outputs;
+    mixer_map_init(&outputs, "Master");
+    mixer_map_add_list(&outputs, "PCM:square, Headphone@1:linear:-10");
+    TQueueElement sample;
+    while (handoff_pop(handoff, &sample))
+    {
+        handoff_drain(handoff, &sample);
+        const int volume = sample.iData;
+        outputs.outputs[0].applied = volume_state_mixer();
+        if (mixer_map_pending(&outputs, volume) == 0)
+        {
+            continue;
+        }
+        volume_state_applying(volume);
+        for (unsigned int i = 0; i < outputs.count; i++)
+        {
+            outputs.outputs[i].applied = mixer_output_level(&outputs.outputs[i], volume);
+        }
+        volume_state_applied(volume, handoff_is_empty(handoff), &sample.iStamp);
+        atomic_fetch_add(&applies, 1);
+    }
+    return nullptr;
+}
+
+// Publish a sample and echo its volume like the main loop does
+static void handle_sample(struct handoff* handoff, const unsigned int adc, const struct timespec* stamp)
+{
+    const unsigned int volume = frame_volume(adc);
+    const bool queued = handoff_push(handoff, (TQueueElement){.iData = (char)volume, .iStamp = *stamp});
+    telemetry_begin();
+    telemetry_set(TELEMETRY_ADC, adc);
+    telemetry_set(TELEMETRY_VOLUME, volume);
+    telemetry_set(TELEMETRY_SAMPLE_NS, telemetry_ns(stamp));
+    telemetry_add(TELEMETRY_SAMPLES, 1);
+    telemetry_add(TELEMETRY_VOLUME_DROPS, queued ? 0 : 1);
+    telemetry_end();
+    if ((int)volume != volume_state_device())
+    {
+        char echo[8];
+        const int len = snprintf(echo, sizeof(echo), "%u\n", volume);
+        if (tx_send(TX_PRIORITY_VOLUME, echo, (size_t)len))
+        {
+            volume_state_set_device((int)volume);
+        }
+    }
+}
+
+// Take what the consumer handed back and send the waiting echoes, once per read like the main loop
+static void handle_loop(void)
+{
+    int volume;
+    struct timespec when;
+    const unsigned long applied = volume_state_take_applied(&volume, &when);
+    if (applied != 0)
+    {
+        telemetry_begin();
+        telemetry_set(TELEMETRY_MIXER_VOLUME, (uint64_t)volume);
+        telemetry_set(TELEMETRY_APPLIED_NS, telemetry_ns(&when));
+        telemetry_add(TELEMETRY_APPLIED, applied);
+        telemetry_end();
+    }
+    if (volume_state_take_resync(&volume))
+    {
+        telemetry_begin();
+        telemetry_set(TELEMETRY_MIXER_VOLUME, (uint64_t)volume);
+        telemetry_end();
+    }
+    tx_pump();
+}
+
+// Feed the text in random read sizes and frame everything, returns the number of valid samples handed over
+static unsigned long ingest(struct TQueue* bytes, unsigned int* ends, struct handoff* handoff, const char* text,
+                            const size_t len, uint64_t* rng)
+{
+    unsigned long samples = 0;
+    size_t fed = 0;
+    while (fed < len || *ends > 0)
+    {
+        handle_loop();
+        size_t chunk = 1 + test_rand_below(rng, READ_MAX);
+        const size_t space = queue_capacity(bytes) - queue_size(bytes);
+        chunk = chunk > len - fed ? len - fed : chunk;
+        chunk = chunk > space ? space : chunk;
+        const struct timespec stamp = {.tv_sec = (time_t)fed};
+        fed += frame_feed(bytes, ends, text + fed, chunk, &stamp);
+        while (*ends > 0)
+        {
+            char frame[FRAME_MAX_BYTES];
+            size_t frame_len = 0;
+            struct timespec frame_stamp;
+            unsigned int adc = 0;
+            if (frame_take(bytes, ends, frame, &frame_len, &frame_stamp) == FRAME_OK &&
+                frame_parse(frame, frame_len, &adc) == FRAME_OK)
+            {
+                handle_sample(handoff, adc, &frame_stamp);
+                samples++;
+            }
+        }
+    }
+    return samples;
+}
+
+int main(void)
+{
+    static char text[65536];
+    TEST_CHECK(alloc_stats_available(), "built without SPC_ALLOC_STATS");
+    uint64_t rng = test_seed();
+    const unsigned long rounds = test_scaled(100);
+
+    // Valid samples mixed with a few broken lines, the same text every round
+    size_t len = 0;
+    while (len + 16 < sizeof(text))
+    {
+        const unsigned int kind = test_rand_below(&rng, 10);
+        len += (size_t)snprintf(text + len, 16, kind == 0 ? "12x4\n" : kind == 1 ? "1234567890\n" : "%u\n",
+                                test_rand_below(&rng, 1024));
+    }
+
+    struct TQueue bytes;
+    struct handoff handoff;
+    queue_init_bounded(&bytes, (size_t)BUFFER_NUMBERS * CONFIG_FRAME_BYTES, QUEUE_OVERFLOW_BLOCK);
+    TEST_CHECK(queue_reserve(&bytes, queue_capacity(&bytes)), "reserve");
+    TEST_CHECK(handoff_init(&handoff, 4, QUEUE_OVERFLOW_COALESCE, 5) == 0, "handoff");
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, nullptr, consume, &handoff) == 0, "consumer");
+    unsigned int ends = 0;
+    char telemetry_name[64];
+    snprintf(telemetry_name, sizeof(telemetry_name), "/spc_alloc_pipeline_%d", (int)getpid());
+    TEST_CHECK(telemetry_open(telemetry_name) == 0, "telemetry %s", telemetry_name);
+    tx_set_sink(count_sink);
+    tx_configure(1000000, TX_BUDGET_MAX);
+
+    // Warm-up, then everything must run out of the preallocated nodes
+    ingest(&bytes, &ends, &handoff, text, len, &rng);
+    alloc_set_hook(on_steady_alloc);
+    alloc_steady_begin();
+    const double start = test_now();
+    unsigned long samples = 0;
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        samples += ingest(&bytes, &ends, &handoff, text, len, &rng);
+    }
+    while (!handoff_is_empty(&handoff))
+    {
+        sched_yield();
+    }
+    const double elapsed = test_now() - start;
+    alloc_steady_end();
+
+    handoff_close(&handoff);
+    pthread_join(thread, nullptr);
+    telemetry_close();
+    handoff_destroy(&handoff);
+    queue_destroy(&bytes);
+    const struct alloc_stats stats = alloc_get_stats();
+    printf("%lu samples in the steady state, %lu applied, %lu echo bytes, %lu allocations before it, %lu in it\n",
+           samples, atomic_load(&applies), echoed, stats.allocs - stats.steady_allocs, stats.steady_allocs);
+    TEST_CHECK(stats.steady_allocs == 0, "%lu steady-state allocations, the first of %zu bytes", stats.steady_allocs,
+               atomic_load(&first_size) - 1);
+    TEST_CHECK(atomic_load(&applies) > 0 && echoed > 0, "the consumer applied %lu volumes, %lu echo bytes sent",
+               atomic_load(&applies), echoed);
+    return test_throughput("steady-state samples", (double)samples, elapsed, "SPC_TEST_MIN_PIPELINE_MOPS", 0.2);
+}
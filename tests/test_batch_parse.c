@@ -0,0 +1,142 @@
+// Equivalence test of the batch parser kernels.
+// Builds a capture of hand-picked edge cases ("0", "00", "0000", five digits, non-digits, empty lines) followed by
+// random lines, parses every line on its own with the live path (frame_parse, frame_volume) as the reference, then
+// checks that the scalar, SSE2 and AVX2 kernels, serial and split across 1 to 8 threads, give the same ADC values,
+// volumes and invalid samples. Instruction sets the CPU lacks are skipped.
+
+#include <stdbool.h>
+#include <string.h>
+#include "../batch_parse.h"
+#include "../frame.h"
+#include "test_util.h"
+
+#define CAPTURE_BYTES (3u << 20) // Above BATCH_PARALLEL_MIN, so the parallel parse really splits
+
+static const char* edge_cases[] = {
+    "0", "00", "000", "0000", "00000", "", "1", "01", "001", "0001", "0010", "0100", "1000", "1020", "1021", "1023",
+    "9999", "10000", "12a", "a", "-1", " 1", "1 ", "\r", "0\r", "/", ":", "99", "512",
+};
+
+static char capture[CAPTURE_BYTES];
+static size_t capture_len;
+static uint16_t expected_adc[CAPTURE_BYTES];
+static uint8_t expected_volume[CAPTURE_BYTES];
+static bool expected_invalid[CAPTURE_BYTES];
+static size_t expected_count;
+
+static uint16_t adc[CAPTURE_BYTES];
+static uint8_t volume[CAPTURE_BYTES];
+static size_t errors[CAPTURE_BYTES];
+
+// Append one line and its reference result
+static void add_line(const char* line, const size_t len)
+{
+    char frame[16];
+    memcpy(frame, line, len);
+    frame[len] = '\n';
+    unsigned int value = 0;
+    const bool valid = frame_parse(frame, len + 1, &value) == FRAME_OK;
+    expected_adc[expected_count] = valid ? (uint16_t)value : 0;
+    expected_volume[expected_count] = valid ? (uint8_t)frame_volume(value) : 0;
+    expected_invalid[expected_count] = !valid;
+    expected_count++;
+    memcpy(capture + capture_len, frame, len + 1);
+    capture_len += len + 1;
+}
+
+static void build_capture(uint64_t* rng)
+{
+    for (size_t i = 0; i < sizeof(edge_cases) / sizeof(edge_cases[0]); i++)
+    {
+        add_line(edge_cases[i], strlen(edge_cases[i]));
+    }
+    // Mostly valid samples, with zeros, non-digits and wrong lengths mixed in
+    static const char alphabet[] = "0000123456789x :";
+    while (capture_len + 8 < CAPTURE_BYTES - 4)
+    {
+        char line[6];
+        const size_t len = test_rand_below(rng, 100) < 90 ? 1 + test_rand_below(rng, 4) : test_rand_below(rng, 7);
+        for (size_t i = 0; i < len; i++)
+        {
+            const unsigned int pick = test_rand_below(rng, 100);
+            line[i] = pick < 95 ? (char)('0' + test_rand_below(rng, 10)) : alphabet[test_rand_below(rng, 16)];
+        }
+        add_line(line, len);
+    }
+    // Trailing bytes without a delimiter are not consumed
+    memcpy(capture + capture_len, "12", 2);
+    capture_len += 2;
+}
+
+static int compare(const char* what, const struct batch_result* result, const size_t consumed)
+{
+    TEST_CHECK(consumed == capture_len - 2, "%s: consumed %zu of %zu", what, consumed, capture_len - 2);
+    TEST_CHECK(result->count == expected_count, "%s: %zu samples, expected %zu", what, result->count, expected_count);
+    size_t error = 0;
+    for (size_t i = 0; i < expected_count; i++)
+    {
+        TEST_CHECK(result->adc[i] == expected_adc[i], "%s: sample %zu ADC %u, expected %u", what, i, result->adc[i],
+                   expected_adc[i]);
+        TEST_CHECK(result->volume[i] == expected_volume[i], "%s: sample %zu volume %u, expected %u", what, i,
+                   result->volume[i], expected_volume[i]);
+        if (expected_invalid[i])
+        {
+            TEST_CHECK(error < result->error_count && result->errors[error] == i, "%s: sample %zu not reported invalid",
+                       what, i);
+            error++;
+        }
+    }
+    TEST_CHECK(error == result->error_count, "%s: %zu invalid samples, expected %zu", what, result->error_count, error);
+    return 0;
+}
+
+int main(void)
+{
+    uint64_t rng = test_seed();
+    build_capture(&rng);
+    size_t invalid = 0;
+    for (size_t i = 0; i < expected_count; i++)
+    {
+        invalid += expected_invalid[i];
+    }
+    printf("%zu bytes, %zu samples, %zu invalid by the live path\n", capture_len, expected_count, invalid);
+
+    static const char* isas[] = {"scalar", "sse2", "avx2"};
+    static const unsigned int threads[] = {1, 2, 3, 8};
+    const unsigned long rounds = test_scaled(4);
+    double parsed = 0.0;
+    double seconds = 0.0;
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++)
+    {
+        if (batch_parse_set_isa(isas[i]) != 0)
+        {
+            printf("%s: not supported by this CPU, skipped\n", isas[i]);
+            continue;
+        }
+        for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+        {
+            for (unsigned long round = 0; round < rounds; round++)
+            {
+                struct batch_result result = {
+                    .adc = adc, .volume = volume, .errors = errors, .capacity = expected_count
+                };
+                memset(adc, 0xff, expected_count * sizeof(adc[0]));
+                memset(volume, 0xff, expected_count * sizeof(volume[0]));
+                const double start = test_now();
+                const size_t consumed = threads[t] == 1
+                                            ? batch_parse(capture, capture_len, &result)
+                                            : batch_parse_parallel(capture, capture_len, &result, threads[t]);
+                seconds += test_now() - start;
+                parsed += (double)expected_count;
+                char what[32];
+                snprintf(what, sizeof(what), "%s, %u threads", isas[i], threads[t]);
+                if (compare(what, &result, consumed) != 0)
+                {
+                    return 1;
+                }
+            }
+        }
+        printf("%s: matches the live path, 1 to 8 threads\n", isas[i]);
+    }
+    return test_throughput("batch samples", parsed, seconds, "SPC_TEST_MIN_BATCH_MOPS", 6.5);
+}
@@ -0,0 +1,218 @@
+// Test of the runtime configuration.
+// Parses a config file with comments, blank lines and spaces around keys and values, a file with broken lines
+// (the valid lines around them must still apply) and a missing file. Every key must reject out-of-range and
+// malformed values without touching the configuration. Command line flags must win over the file whatever their
+// order, invalid flags must fail and --help must return 2. A reload merge must keep device, io and telemetry, and
+// keep baud and vtime or buffer_numbers when reinitializing the port or growing the buffer fails.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../config.h"
+#include "test_util.h"
+
+static char dir[64]; // Holds the config files
+static char conf_path[96];
+
+// Write the config file
+static int write_conf(const char* text)
+{
+    FILE* file = fopen(conf_path, "w");
+    if (file == nullptr)
+    {
+        return 1;
+    }
+    fputs(text, file);
+    fclose(file);
+    return 0;
+}
+
+static int check_file(void)
+{
+    struct config cfg;
+    config_defaults(&cfg);
+    TEST_CHECK(write_conf("# spc.conf\n"
+                          "\n"
+                          "  device = /dev/ttyUSB1   # trailing comment\n"
+                          "baud=57600\n"
+                          "vtime = 0\n"
+                          "mixer_outputs = PCM:square, Headphone@1:linear:-10\n"
+                          "\tvolume_policy\t=\tdrop_oldest\n"
+                          "io = plain\n"
+                          "telemetry =\n") == 0, "write %s", conf_path);
+    TEST_CHECK(config_load_file(&cfg, conf_path, 1) == 0, "valid file rejected");
+    TEST_CHECK(strcmp(cfg.device, "/dev/ttyUSB1") == 0, "device %s", cfg.device);
+    TEST_CHECK(cfg.baud == 57600 && cfg.vtime == 0, "baud %d, vtime %d", cfg.baud, cfg.vtime);
+    TEST_CHECK(strcmp(cfg.mixer_outputs, "PCM:square, Headphone@1:linear:-10") == 0, "mixer_outputs %s",
+               cfg.mixer_outputs);
+    TEST_CHECK(cfg.volume_policy == QUEUE_OVERFLOW_DROP_OLDEST && !cfg.io_uring && cfg.telemetry[0] == '\0',
+               "policy, io or telemetry");
+    TEST_CHECK(cfg.buffer_numbers == 50 && strcmp(cfg.mixer_control, "Master") == 0, "defaults of unset keys");
+
+    // Every broken line is reported, the others still apply
+    config_defaults(&cfg);
+    TEST_CHECK(write_conf("baud = 12345\n"
+                          "no equals sign\n"
+                          "bogus_key = 1\n"
+                          "vtime = 256\n"
+                          "buffer_numbers = 20\n") == 0, "write %s", conf_path);
+    TEST_CHECK(config_load_file(&cfg, conf_path, 1) != 0, "broken file accepted");
+    TEST_CHECK(cfg.baud == 115200 && cfg.vtime == 5 && cfg.buffer_numbers == 20, "baud %d, vtime %d, buffer %u",
+               cfg.baud, cfg.vtime, cfg.buffer_numbers);
+
+    char missing[112];
+    snprintf(missing, sizeof(missing), "%s/missing.conf", dir);
+    TEST_CHECK(config_load_file(&cfg, missing, 1) != 0, "missing required file accepted");
+    TEST_CHECK(config_load_file(&cfg, missing, 0) == 0, "missing optional file rejected");
+    printf("config file: comments, spaces, broken lines and missing files\n");
+    return 0;
+}
+
+static int check_values(void)
+{
+    static const struct
+    {
+        const char* key;
+        const char* value;
+    } invalid[] = {
+        {"device", ""}, {"baud", "12345"}, {"baud", "115200x"}, {"baud", ""}, {"vtime", "-1"}, {"vtime", "256"},
+        {"buffer_numbers", "0"}, {"buffer_numbers", "100001"}, {"coalesce_us", "-5"}, {"mixer_control", ""},
+        {"mixer_control", "Bad'Name"}, {"mixer_outputs", "PCM:bogus"}, {"mixer_outputs", "PCM, PCM"},
+        {"volume_queue", "0"}, {"volume_policy", "lifo"}, {"mixer_wait_ms", "0"}, {"mixer_cpu", "-2"},
+        {"io", "epoll"}, {"tx_rate", "1000001"}, {"tx_budget", "0"}, {"steady_alloc", "never"}, {"bogus", "1"},
+    };
+    struct config defaults;
+    config_defaults(&defaults);
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        struct config cfg;
+        config_defaults(&cfg);
+        TEST_CHECK(config_set(&cfg, invalid[i].key, invalid[i].value) != 0, "accepted %s = \"%s\"", invalid[i].key,
+                   invalid[i].value);
+        TEST_CHECK(memcmp(&cfg, &defaults, sizeof(cfg)) == 0, "rejected %s = \"%s\" changed the configuration",
+                   invalid[i].key, invalid[i].value);
+    }
+    struct config cfg;
+    config_defaults(&cfg);
+    TEST_CHECK(config_set(&cfg, "buffer_numbers", "20") == 0, "buffer_numbers");
+    TEST_CHECK(config_buffer_bytes(&cfg) == 20 * (FRAME_MAX_DIGITS + 1), "%zu buffer bytes",
+               config_buffer_bytes(&cfg));
+    printf("invalid values rejected\n");
+    return 0;
+}
+
+// Parse a command line and build the configuration from it, returns the first nonzero result
+static int build_args(struct config* cfg, const int argc, char** argv)
+{
+    struct config_args args;
+    const int parsed = config_parse_args(&args, argc, argv);
+    return parsed != 0 ? parsed : config_build(cfg, &args);
+}
+
+static int check_args(void)
+{
+    TEST_CHECK(write_conf("baud = 57600\nvtime = 7\nbuffer_numbers = 20\nio = uring\n") == 0, "write %s",
+               conf_path);
+    struct config cfg;
+    char* flags_last[] = {"spc", "--config", conf_path, "--baud", "230400", "--vtime", "0", "--io", "plain"};
+    TEST_CHECK(build_args(&cfg, 9, flags_last) == 0, "command line rejected");
+    TEST_CHECK(cfg.baud == 230400 && cfg.vtime == 0 && !cfg.io_uring && cfg.buffer_numbers == 20,
+               "baud %d, vtime %d, io_uring %d, buffer %u", cfg.baud, cfg.vtime, cfg.io_uring, cfg.buffer_numbers);
+    char* flags_first[] = {"spc", "--buffer-numbers", "30", "-c", conf_path};
+    TEST_CHECK(build_args(&cfg, 5, flags_first) == 0 && cfg.buffer_numbers == 30 && cfg.baud == 57600,
+               "flag before --config lost to the file");
+
+    char* invalid_flag[] = {"spc", "--baud", "1"};
+    TEST_CHECK(build_args(&cfg, 3, invalid_flag) == 1, "invalid flag value accepted");
+    char* unknown_flag[] = {"spc", "--bogus", "1"};
+    TEST_CHECK(build_args(&cfg, 3, unknown_flag) == 1, "unknown flag accepted");
+    char* extra_argument[] = {"spc", "extra"};
+    TEST_CHECK(build_args(&cfg, 2, extra_argument) == 1, "extra argument accepted");
+    char* help[] = {"spc", "--help"};
+    TEST_CHECK(build_args(&cfg, 2, help) == 2, "help not reported");
+
+    // Checked once file and flags are merged, the flag repeats the control set in the file
+    TEST_CHECK(write_conf("mixer_outputs = PCM:square, Headphone\n") == 0, "write %s", conf_path);
+    char* repeating[] = {"spc", "-c", conf_path, "--mixer-control", "PCM"};
+    TEST_CHECK(build_args(&cfg, 5, repeating) == 1, "mixer_outputs repeating mixer_control accepted");
+    printf("command line over the config file\n");
+    return 0;
+}
+
+static bool port_fails;
+static bool buffer_fails;
+static int port_calls;
+static int port_baud;
+static size_t buffer_bytes;
+
+static int fake_port(const int baud, const int vtime)
+{
+    (void)vtime;
+    port_calls++;
+    port_baud = baud;
+    return port_fails;
+}
+
+static int fake_buffer(const size_t bytes)
+{
+    buffer_bytes = bytes;
+    return buffer_fails;
+}
+
+static int check_merge(void)
+{
+    const struct config_apply apply = {fake_port, fake_buffer};
+    struct config active;
+    config_defaults(&active);
+    struct config reloaded = active;
+    strcpy(reloaded.device, "/dev/ttyUSB9");
+    reloaded.io_uring = 0;
+    reloaded.telemetry[0] = '\0';
+    reloaded.baud = 57600;
+    reloaded.vtime = 0;
+    reloaded.buffer_numbers = 80;
+    reloaded.tx_rate = 1000;
+
+    // Keys that need a restart keep their values, the others are taken
+    struct config next = reloaded;
+    config_merge(&next, &active, &apply);
+    TEST_CHECK(strcmp(next.device, active.device) == 0 && next.io_uring == active.io_uring &&
+               strcmp(next.telemetry, active.telemetry) == 0, "device, io or telemetry changed");
+    TEST_CHECK(next.baud == 57600 && next.vtime == 0 && next.buffer_numbers == 80 && next.tx_rate == 1000,
+               "reloaded values lost");
+    TEST_CHECK(port_calls == 1 && port_baud == 57600 && buffer_bytes == 80 * CONFIG_FRAME_BYTES,
+               "%d port calls, baud %d, %zu buffer bytes", port_calls, port_baud, buffer_bytes);
+
+    // Failed applies keep the active values
+    port_fails = true;
+    buffer_fails = true;
+    next = reloaded;
+    config_merge(&next, &active, &apply);
+    TEST_CHECK(next.baud == active.baud && next.vtime == active.vtime, "baud %d, vtime %d after a failed port",
+               next.baud, next.vtime);
+    TEST_CHECK(next.buffer_numbers == active.buffer_numbers, "buffer %u after a failed resize", next.buffer_numbers);
+    TEST_CHECK(next.tx_rate == 1000, "tx_rate lost with the failed applies");
+
+    // The port is left alone when neither baud nor vtime change
+    port_calls = 0;
+    next = active;
+    config_merge(&next, &active, &apply);
+    TEST_CHECK(port_calls == 0, "port reinitialized without a change");
+    TEST_CHECK(next.buffer_numbers == active.buffer_numbers, "buffer %u", next.buffer_numbers);
+    printf("reload merge keeps restart-only and failed settings\n");
+    return 0;
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    snprintf(dir, sizeof(dir), "/tmp/spc_config_%d", (int)getpid());
+    snprintf(conf_path, sizeof(conf_path), "%s/spc.conf", dir);
+    TEST_CHECK(mkdir(dir, 0700) == 0, "mkdir %s", dir);
+    const int failed = check_file() || check_values() || check_args() || check_merge();
+    remove(conf_path);
+    rmdir(dir);
+    return failed;
+}
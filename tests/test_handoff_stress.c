@@ -0,0 +1,220 @@
+// Producer/consumer stress of the handoff between the reader and the mixer thread.
+// Producers push numbered samples as fast as they can while a consumer pops them. For every overflow policy the
+// consumer must see each producer's samples in order and nothing may be lost without being counted as dropped.
+// With a single producer the policies that keep the newest sample must deliver the last one. Further runs
+// reconfigure the handoff while it is busy (as a config reload does) and close it under a blocked producer.
+// Build with -DSPC_SANITIZER=thread to run it under TSan.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "../handoff.h"
+#include "test_util.h"
+
+#define MAX_PRODUCERS 4
+
+struct run
+{
+    struct handoff handoff;
+    enum TQueueOverflowPolicy policy;
+    unsigned int producers;
+    unsigned long per_producer; // Samples pushed by each producer
+    atomic_ulong pushed; // Pushes reported as queued
+    unsigned int last_seq[MAX_PRODUCERS]; // Consumer side, last sample seen from each producer
+    unsigned long received;
+    bool out_of_order;
+    bool gap; // A sample went missing under the block policy
+    atomic_int reconfigure; // Reconfiguring thread keeps going while set
+};
+
+struct producer
+{
+    struct run* run;
+    unsigned int id;
+};
+
+// The producer id travels in iData, the sample number in iSeq
+static void* produce(void* arg)
+{
+    const struct producer* producer = arg;
+    struct run* run = producer->run;
+    for (unsigned int seq = 1; seq <= run->per_producer; seq++)
+    {
+        if (handoff_push(&run->handoff, (TQueueElement){.iData = (char)producer->id, .iSeq = seq}))
+        {
+            atomic_fetch_add(&run->pushed, 1);
+        }
+    }
+    return nullptr;
+}
+
+static void* consume(void* arg)
+{
+    struct run* run = arg;
+    TQueueElement sample;
+    while (handoff_pop(&run->handoff, &sample))
+    {
+        const unsigned int id = (unsigned int)sample.iData;
+        if (id >= run->producers || sample.iSeq <= run->last_seq[id])
+        {
+            run->out_of_order = true;
+        }
+        else if (run->policy == QUEUE_OVERFLOW_BLOCK && sample.iSeq != run->last_seq[id] + 1)
+        {
+            run->gap = true;
+        }
+        if (id < run->producers)
+        {
+            run->last_seq[id] = sample.iSeq;
+        }
+        run->received++;
+    }
+    return nullptr;
+}
+
+// Change the capacity back and forth while samples flow, the policy stays
+static void* reconfigure(void* arg)
+{
+    struct run* run = arg;
+    unsigned int step = 0;
+    while (atomic_load(&run->reconfigure))
+    {
+        handoff_configure(&run->handoff, 1 + step % 8, run->policy, 5);
+        step++;
+    }
+    return nullptr;
+}
+
+// Run producers against one consumer until every sample was pushed and the queue is drained
+static int stress(const char* name, const size_t capacity, const enum TQueueOverflowPolicy policy,
+                  const unsigned int producers, const unsigned long per_producer, const bool reconfiguring,
+                  double* samples, double* seconds)
+{
+    static struct run run;
+    run = (struct run){.policy = policy, .producers = producers, .per_producer = per_producer};
+    atomic_store(&run.reconfigure, reconfiguring);
+    TEST_CHECK(handoff_init(&run.handoff, capacity, policy, 5) == 0, "init %s", name);
+
+    const double start = test_now();
+    pthread_t consumer;
+    pthread_t reconfigurer;
+    pthread_t threads[MAX_PRODUCERS];
+    struct producer args[MAX_PRODUCERS];
+    TEST_CHECK(pthread_create(&consumer, nullptr, consume, &run) == 0, "consumer %s", name);
+    if (reconfiguring)
+    {
+        TEST_CHECK(pthread_create(&reconfigurer, nullptr, reconfigure, &run) == 0, "reconfigurer %s", name);
+    }
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        args[i] = (struct producer){.run = &run, .id = i};
+        TEST_CHECK(pthread_create(&threads[i], nullptr, produce, &args[i]) == 0, "producer %s", name);
+    }
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        pthread_join(threads[i], nullptr);
+    }
+    atomic_store(&run.reconfigure, 0);
+    if (reconfiguring)
+    {
+        pthread_join(reconfigurer, nullptr);
+    }
+    // Let the consumer drain what is left before closing
+    while (!handoff_is_empty(&run.handoff))
+    {
+        sched_yield();
+    }
+    handoff_close(&run.handoff);
+    pthread_join(consumer, nullptr);
+    const double elapsed = test_now() - start;
+
+    const unsigned long total = (unsigned long)producers * per_producer;
+    const size_t dropped = handoff_dropped(&run.handoff);
+    printf("%s: %lu pushed, %lu received, %zu dropped, %.3f s\n", name, atomic_load(&run.pushed), run.received,
+           dropped, elapsed);
+    TEST_CHECK(!run.out_of_order, "%s: samples out of order", name);
+    TEST_CHECK(!run.gap, "%s: sample lost under the block policy", name);
+    TEST_CHECK(run.received + dropped == total, "%s: %lu received + %zu dropped != %lu", name, run.received,
+               dropped, total);
+    if (policy == QUEUE_OVERFLOW_BLOCK)
+    {
+        TEST_CHECK(dropped == 0 && run.received == total, "%s: block policy lost samples", name);
+    }
+    // With several producers the newest sample of one can be dropped or coalesced in favour of another
+    if (policy != QUEUE_OVERFLOW_DROP_NEWEST && producers == 1)
+    {
+        for (unsigned int i = 0; i < producers; i++)
+        {
+            TEST_CHECK(run.last_seq[i] == per_producer, "%s: newest sample of producer %u missing", name, i);
+        }
+    }
+    handoff_destroy(&run.handoff);
+    *samples += (double)total;
+    *seconds += elapsed;
+    return 0;
+}
+
+struct blocked
+{
+    struct handoff* handoff;
+    atomic_int done;
+    bool pushed;
+};
+
+static void* push_blocked(void* arg)
+{
+    struct blocked* blocked = arg;
+    blocked->pushed = handoff_push(blocked->handoff, (TQueueElement){.iSeq = 2});
+    atomic_store(&blocked->done, 1);
+    return nullptr;
+}
+
+// A producer waiting for room must give up once the handoff is closed
+static int close_while_blocked(void)
+{
+    struct handoff handoff;
+    TEST_CHECK(handoff_init(&handoff, 1, QUEUE_OVERFLOW_BLOCK, 1000) == 0, "init");
+    TEST_CHECK(handoff_push(&handoff, (TQueueElement){.iSeq = 1}), "first push");
+    struct blocked blocked = {.handoff = &handoff};
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, nullptr, push_blocked, &blocked) == 0, "thread");
+    const struct timespec pause = {0, 20000000};
+    nanosleep(&pause, nullptr);
+    TEST_CHECK(!atomic_load(&blocked.done), "push into a full queue did not block");
+    const double start = test_now();
+    handoff_close(&handoff);
+    pthread_join(thread, nullptr);
+    const double waited = test_now() - start;
+    TEST_CHECK(!blocked.pushed, "push succeeded after close");
+    TEST_CHECK(waited < 0.5, "close took %.3f s to release the producer", waited);
+    TQueueElement sample;
+    TEST_CHECK(!handoff_pop(&handoff, &sample), "pop succeeded after close");
+    handoff_destroy(&handoff);
+    printf("close releases a blocked producer after %.3f ms\n", waited * 1000.0);
+    return 0;
+}
+
+int main(void)
+{
+    const unsigned long count = test_scaled(200000);
+    double samples = 0.0;
+    double seconds = 0.0;
+    int failed = 0;
+
+    failed |= stress("block, capacity 4", 4, QUEUE_OVERFLOW_BLOCK, 1, count, false, &samples, &seconds);
+    failed |= stress("block, capacity 1", 1, QUEUE_OVERFLOW_BLOCK, 1, count, false, &samples, &seconds);
+    failed |= stress("block, 4 producers", 4, QUEUE_OVERFLOW_BLOCK, 4, count / 4, false, &samples, &seconds);
+    failed |= stress("drop_oldest", 4, QUEUE_OVERFLOW_DROP_OLDEST, 1, count, false, &samples, &seconds);
+    failed |= stress("drop_newest", 4, QUEUE_OVERFLOW_DROP_NEWEST, 1, count, false, &samples, &seconds);
+    failed |= stress("coalesce", 4, QUEUE_OVERFLOW_COALESCE, 1, count, false, &samples, &seconds);
+    failed |= stress("coalesce, 2 producers", 4, QUEUE_OVERFLOW_COALESCE, 2, count / 2, false, &samples, &seconds);
+    failed |= stress("block, reconfigured", 4, QUEUE_OVERFLOW_BLOCK, 1, count, true, &samples, &seconds);
+    failed |= stress("coalesce, reconfigured", 4, QUEUE_OVERFLOW_COALESCE, 1, count, true, &samples, &seconds);
+    failed |= close_while_blocked();
+    if (failed)
+    {
+        return 1;
+    }
+    return test_throughput("handoff samples", samples, seconds, "SPC_TEST_MIN_HANDOFF_MOPS", 0.2);
+}
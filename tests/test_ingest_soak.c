@@ -0,0 +1,259 @@
+// Soak test of the ingest pipeline fed from a synthetic byte stream.
+// A generator writes lines the way the device sends them, mixed with the faults seen on a real link: non-digits,
+// zero padding, numbers that are too long and runaway lines without an end byte in time. The stream is fed
+// in random read sizes into a bounded byte queue (frame_feed), framed (frame_take), parsed (frame_parse) and the
+// volumes are handed to a consumer thread through a coalescing handoff, as the main loop and the mixer thread
+// do. Every frame is checked against a reference decoding of the generated text. Runs for
+// SPC_TEST_SOAK_SECONDS (default 3).
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../config.h"
+#include "../frame.h"
+#include "../handoff.h"
+#include "test_util.h"
+
+#define BLOCK_BYTES 65536 // Generated text per round
+#define BLOCK_FRAMES BLOCK_BYTES // Upper bound of the frames in one block
+#define BUFFER_NUMBERS 50 // Receive buffer of the default configuration
+#define READ_MAX 64 // Largest single read
+
+struct expected
+{
+    enum frame_status status;
+    unsigned int adc;
+    size_t offset; // Stream offset of the first byte of the frame
+};
+
+struct block
+{
+    char text[BLOCK_BYTES + 32];
+    size_t len;
+    struct expected frames[BLOCK_FRAMES];
+    size_t count;
+};
+
+struct consumer
+{
+    struct handoff handoff;
+    atomic_uint last_seq;
+    atomic_uint last_volume;
+    atomic_bool out_of_order;
+};
+
+// Reference decoding of one line of len characters (without the end byte), under the rules in frame.h
+static void expect_line(struct block* block, const char* line, size_t len, size_t offset)
+{
+    // Six bytes without an end byte are a runaway and are dropped
+    while (len >= FRAME_MAX_BYTES)
+    {
+        line += FRAME_MAX_BYTES;
+        len -= FRAME_MAX_BYTES;
+        offset += FRAME_MAX_BYTES;
+    }
+    struct expected* frame = &block->frames[block->count++];
+    *frame = (struct expected){.status = FRAME_OK, .offset = offset};
+    if (len > FRAME_MAX_DIGITS)
+    {
+        frame->status = FRAME_TOO_LONG;
+        return;
+    }
+    size_t zeros = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (line[i] < '0' || line[i] > '9')
+        {
+            frame->status = FRAME_INVALID;
+            return;
+        }
+        frame->adc = frame->adc * 10 + (unsigned int)(line[i] - '0');
+        zeros += line[i] == '0';
+    }
+    // An empty line or padded zero ("00") is not a number
+    if (len == 0 || (zeros == len && len > 1))
+    {
+        frame->status = FRAME_INVALID;
+    }
+}
+
+// Generate one block of lines starting at stream offset base. Lines whose handling would depend on where a read
+// ends are not generated: empty lines, and runaways whose end byte directly follows a dropped run of six bytes
+static void generate(struct block* block, uint64_t* rng, const size_t base)
+{
+    static const char junk[] = "x-+. aZ\r\t";
+    block->len = 0;
+    block->count = 0;
+    while (block->len < BLOCK_BYTES)
+    {
+        char* line = block->text + block->len;
+        size_t len = 0;
+        const unsigned int kind = test_rand_below(rng, 100);
+        if (kind < 75)
+        {
+            // A valid sample, sometimes zero padded
+            const unsigned int adc = test_rand_below(rng, 1024);
+            const int width = test_rand_below(rng, 4) == 0 ? 1 + (int)test_rand_below(rng, FRAME_MAX_DIGITS) : 0;
+            len = (size_t)snprintf(line, 8, "%0*u", width, adc);
+        }
+        else if (kind < 85)
+        {
+            // Digits with a stray character
+            len = 1 + test_rand_below(rng, FRAME_MAX_DIGITS);
+            for (size_t i = 0; i < len; i++)
+            {
+                line[i] = (char)('0' + test_rand_below(rng, 10));
+            }
+            line[test_rand_below(rng, (unsigned int)len)] = junk[test_rand_below(rng, sizeof(junk) - 1)];
+        }
+        else if (kind < 93)
+        {
+            // One digit too many
+            len = FRAME_MAX_DIGITS + 1;
+            for (size_t i = 0; i < len; i++)
+            {
+                line[i] = (char)('0' + test_rand_below(rng, 10));
+            }
+        }
+        else
+        {
+            // A runaway line
+            do
+            {
+                len = FRAME_MAX_BYTES + 1 + test_rand_below(rng, 20);
+            }
+            while (len % FRAME_MAX_BYTES == 0);
+            for (size_t i = 0; i < len; i++)
+            {
+                line[i] = (char)('0' + test_rand_below(rng, 10));
+            }
+        }
+        expect_line(block, line, len, base + block->len);
+        line[len] = '\n';
+        block->len += len + 1;
+    }
+}
+
+static void* consume(void* arg)
+{
+    struct consumer* consumer = arg;
+    TQueueElement sample;
+    while (handoff_pop(&consumer->handoff, &sample))
+    {
+        if (sample.iSeq <= atomic_load(&consumer->last_seq))
+        {
+            atomic_store(&consumer->out_of_order, true);
+        }
+        atomic_store(&consumer->last_volume, (unsigned char)sample.iData);
+        atomic_store(&consumer->last_seq, sample.iSeq);
+    }
+    return nullptr;
+}
+
+// Take and check one frame, the stamp carries the stream offset and length of the read that delivered its first byte
+static int take_frame(struct TQueue* bytes, unsigned int* ends, const struct block* block, size_t* next,
+                      unsigned int* seq, struct consumer* consumer, unsigned int* last_volume)
+{
+    char frame[FRAME_MAX_BYTES];
+    size_t len = 0;
+    struct timespec stamp;
+    if (frame_take(bytes, ends, frame, &len, &stamp) == FRAME_RUNAWAY)
+    {
+        return 0;
+    }
+    TEST_CHECK(*next < block->count, "more frames than generated");
+    const struct expected* expected = &block->frames[(*next)++];
+    unsigned int adc = 0;
+    const enum frame_status status = frame_parse(frame, len, &adc);
+    TEST_CHECK(status == expected->status, "frame at %zu: status %d, expected %d", expected->offset, status,
+               expected->status);
+    TEST_CHECK(expected->offset >= (size_t)stamp.tv_sec && expected->offset < (size_t)(stamp.tv_sec + stamp.tv_nsec),
+               "frame at %zu stamped by the read of %ld..%ld", expected->offset, (long)stamp.tv_sec,
+               (long)(stamp.tv_sec + stamp.tv_nsec));
+    (*seq)++;
+    if (status == FRAME_OK)
+    {
+        TEST_CHECK(adc == expected->adc, "frame at %zu: adc %u, expected %u", expected->offset, adc, expected->adc);
+        const unsigned int volume = frame_volume(adc);
+        TEST_CHECK(volume == (adc > 1020 ? 100 : adc * 100 / 1024), "volume of %u", adc);
+        handoff_push(&consumer->handoff, (TQueueElement){.iData = (char)volume, .iSeq = *seq});
+        *last_volume = volume;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static struct block block;
+    static struct consumer consumer;
+    uint64_t rng = test_seed();
+    const double duration = test_env("SPC_TEST_SOAK_SECONDS", 3.0);
+
+    struct TQueue bytes;
+    queue_init_bounded(&bytes, (size_t)BUFFER_NUMBERS * CONFIG_FRAME_BYTES, QUEUE_OVERFLOW_BLOCK);
+    TEST_CHECK(queue_reserve(&bytes, queue_capacity(&bytes)), "reserve");
+    TEST_CHECK(handoff_init(&consumer.handoff, 4, QUEUE_OVERFLOW_COALESCE, 5) == 0, "handoff");
+    pthread_t thread;
+    TEST_CHECK(pthread_create(&thread, nullptr, consume, &consumer) == 0, "consumer");
+
+    unsigned int ends = 0;
+    unsigned int seq = 0;
+    unsigned int last_volume = 0;
+    size_t stream = 0;
+    unsigned long frames = 0;
+    const double start = test_now();
+    do
+    {
+        generate(&block, &rng, stream);
+        size_t fed = 0;
+        size_t next = 0;
+        while (fed < block.len || ends > 0)
+        {
+            // Read what fits, the rest stays in the "port" for the next read
+            const size_t space = queue_capacity(&bytes) - queue_size(&bytes);
+            size_t chunk = 1 + test_rand_below(&rng, READ_MAX);
+            chunk = chunk > block.len - fed ? block.len - fed : chunk;
+            chunk = chunk > space ? space : chunk;
+            if (chunk > 0)
+            {
+                const struct timespec stamp = {.tv_sec = (time_t)(stream + fed), .tv_nsec = (long)chunk};
+                const size_t queued = frame_feed(&bytes, &ends, block.text + fed, chunk, &stamp);
+                TEST_CHECK(queued == chunk, "queued %zu of %zu free bytes", queued, chunk);
+                fed += queued;
+            }
+            TEST_CHECK(ends > 0 || fed < block.len || queue_is_empty(&bytes), "bytes left without an end byte");
+            TEST_CHECK(ends > 0 || !queue_is_full(&bytes), "full buffer without an end byte");
+            // Frame a few numbers between reads, like the main loop
+            for (unsigned int i = test_rand_below(&rng, 4); i > 0 && ends > 0; i--)
+            {
+                if (take_frame(&bytes, &ends, &block, &next, &seq, &consumer, &last_volume) != 0)
+                {
+                    return 1;
+                }
+            }
+        }
+        TEST_CHECK(next == block.count, "%zu of %zu frames seen", next, block.count);
+        TEST_CHECK(queue_is_empty(&bytes), "bytes left after the block");
+        stream += block.len;
+        frames += block.count;
+    }
+    while (test_now() - start < duration);
+
+    // The coalescing handoff may skip volumes but must end on the newest one
+    while (!handoff_is_empty(&consumer.handoff))
+    {
+        sched_yield();
+    }
+    const double elapsed = test_now() - start;
+    handoff_close(&consumer.handoff);
+    pthread_join(thread, nullptr);
+    printf("%zu bytes, %lu frames, %zu volumes coalesced\n", stream, frames, handoff_dropped(&consumer.handoff));
+    TEST_CHECK(!atomic_load(&consumer.out_of_order), "volumes out of order");
+    TEST_CHECK(atomic_load(&consumer.last_volume) == last_volume, "consumer ended on %u, expected %u",
+               atomic_load(&consumer.last_volume), last_volume);
+    handoff_destroy(&consumer.handoff);
+    queue_destroy(&bytes);
+    return test_throughput("ingested frames", (double)frames, elapsed, "SPC_TEST_MIN_INGEST_MOPS", 0.2);
+}
@@ -0,0 +1,231 @@
+// Test of the mixer output map.
+// Parses valid and malformed mixer_outputs lists, checks the level curves with their offsets and clamping and the
+// count of pending outputs, then applies maps through a fake amixer placed first in PATH that logs its arguments
+// and stdin: every card must get exactly one process with the commands of its pending outputs, and the outputs of
+// a failed process must end up unknown. Finally mixer_outputs is checked against mixer_control in either key
+// order of the config file.
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../config.h"
+#include "../mixer_map.h"
+#include "../volume_state.h"
+#include "test_util.h"
+
+static char dir[64]; // Holds the fake amixer, its log and the config files
+static char log_path[96];
+
+static int check_parse(void)
+{
+    struct mixer_map map;
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, " PCM:square , Headphone@1:linear:-10,Speaker@card2:cube: 5 ") == 0, "valid");
+    TEST_CHECK(map.count == 4, "%u outputs", map.count);
+    TEST_CHECK(strcmp(map.outputs[1].control, "PCM") == 0 && map.outputs[1].card[0] == '\0' &&
+               map.outputs[1].curve == MIXER_CURVE_SQUARE && map.outputs[1].offset == 0, "PCM");
+    TEST_CHECK(strcmp(map.outputs[2].control, "Headphone") == 0 && strcmp(map.outputs[2].card, "1") == 0 &&
+               map.outputs[2].curve == MIXER_CURVE_LINEAR && map.outputs[2].offset == -10, "Headphone");
+    TEST_CHECK(strcmp(map.outputs[3].card, "card2") == 0 && map.outputs[3].curve == MIXER_CURVE_CUBE &&
+               map.outputs[3].offset == 5 && map.outputs[3].applied == VOLUME_UNKNOWN, "Speaker");
+
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "  ") == 0 && map.count == 1, "empty list");
+    TEST_CHECK(mixer_map_add_list(&map, "Front Mic@0") == 0 && strcmp(map.outputs[1].control, "Front Mic") == 0,
+               "control with a space");
+
+    static const char* malformed[] = {
+        "PCM:bogus", "PCM:linear:abc", "PCM:linear:101", "PCM:linear:-101", "PCM:linear:5:6", "@1", "PCM@",
+        "PCM@ ", "Bad'Quote", "PCM@'1'", "A_control_name_that_is_far_too_long_to_fit_into_the_sixty_four_bytes",
+    };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++)
+    {
+        mixer_map_init(&map, "Master");
+        TEST_CHECK(mixer_map_add_list(&map, malformed[i]) == MIXER_MAP_MALFORMED, "accepted \"%s\"", malformed[i]);
+    }
+    static const char* repeated[] = {"Master", "PCM, PCM", "PCM@1, Master@1, PCM@1"};
+    for (size_t i = 0; i < sizeof(repeated) / sizeof(repeated[0]); i++)
+    {
+        mixer_map_init(&map, "Master");
+        TEST_CHECK(mixer_map_add_list(&map, repeated[i]) == MIXER_MAP_REPEATED, "accepted \"%s\"", repeated[i]);
+    }
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "PCM, PCM@1, Master@1") == 0, "same control on other cards");
+
+    // Seven outputs besides the primary fit, eight do not
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "A, B, C, D, E, F, G") == 0 && map.count == MIXER_MAX_OUTPUTS, "full map");
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "A, B, C, D, E, F, G, H") == MIXER_MAP_TOO_MANY, "too many outputs");
+
+    char too_long[MIXER_OUTPUTS_SIZE + 1];
+    memset(too_long, 'A', sizeof(too_long) - 1);
+    too_long[sizeof(too_long) - 1] = '\0';
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, too_long) == MIXER_MAP_TOO_LONG, "list longer than MIXER_OUTPUTS_SIZE");
+    return 0;
+}
+
+static int check_levels(void)
+{
+    static const struct
+    {
+        enum mixer_curve curve;
+        int offset;
+        int volume;
+        int level;
+    } cases[] = {
+        {MIXER_CURVE_LINEAR, 0, 0, 0}, {MIXER_CURVE_LINEAR, 0, 37, 37}, {MIXER_CURVE_LINEAR, 0, 100, 100},
+        {MIXER_CURVE_SQUARE, 0, 50, 25}, {MIXER_CURVE_SQUARE, 0, 9, 0}, {MIXER_CURVE_SQUARE, 0, 100, 100},
+        {MIXER_CURVE_CUBE, 0, 50, 12}, {MIXER_CURVE_CUBE, 0, 100, 100}, {MIXER_CURVE_CUBE, 0, 20, 0},
+        {MIXER_CURVE_LINEAR, -10, 5, 0}, {MIXER_CURVE_LINEAR, -10, 50, 40}, {MIXER_CURVE_LINEAR, 10, 95, 100},
+        {MIXER_CURVE_SQUARE, 20, 50, 45}, {MIXER_CURVE_CUBE, 100, 0, 100}, {MIXER_CURVE_CUBE, -100, 100, 0},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        const struct mixer_output output = {.curve = cases[i].curve, .offset = cases[i].offset};
+        const int level = mixer_output_level(&output, cases[i].volume);
+        TEST_CHECK(level == cases[i].level, "%s%+d at %d: %d, expected %d", mixer_curve_name(cases[i].curve),
+                   cases[i].offset, cases[i].volume, level, cases[i].level);
+    }
+    // Every curve is monotonic and stays within 0..100
+    for (int curve = MIXER_CURVE_LINEAR; curve <= MIXER_CURVE_CUBE; curve++)
+    {
+        for (int offset = -100; offset <= 100; offset += 25)
+        {
+            const struct mixer_output output = {.curve = (enum mixer_curve)curve, .offset = offset};
+            int previous = 0;
+            for (int volume = 0; volume <= 100; volume++)
+            {
+                const int level = mixer_output_level(&output, volume);
+                TEST_CHECK(level >= previous && level <= 100, "%s%+d at %d: %d", mixer_curve_name(output.curve),
+                           offset, volume, level);
+                previous = level;
+            }
+        }
+    }
+
+    struct mixer_map map;
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "PCM:square, Headphone@1:linear:-10") == 0, "map");
+    TEST_CHECK(mixer_map_pending(&map, 10) == 3, "unknown levels are pending");
+    map.outputs[0].applied = 10;
+    map.outputs[1].applied = 1;
+    TEST_CHECK(mixer_map_pending(&map, 10) == 1, "two outputs at their level");
+    map.outputs[2].applied = 0;
+    TEST_CHECK(mixer_map_pending(&map, 10) == 0, "all outputs at their level");
+    TEST_CHECK(mixer_map_pending(&map, 11) == 2, "the square of 11 is still 1, the others move");
+    return 0;
+}
+
+// Contents of the fake amixer log, cleared afterwards
+static const char* take_log(void)
+{
+    static char text[4096];
+    text[0] = '\0';
+    FILE* file = fopen(log_path, "r");
+    if (file != nullptr)
+    {
+        text[fread(text, 1, sizeof(text) - 1, file)] = '\0';
+        fclose(file);
+        remove(log_path);
+    }
+    return text;
+}
+
+static int check_apply(void)
+{
+    struct mixer_map map;
+    mixer_map_init(&map, "Master");
+    TEST_CHECK(mixer_map_add_list(&map, "Headphone@1:linear:-10, PCM:square, Speaker@1, Line@bad") == 0, "map");
+    take_log();
+
+    // One process per card in the order of the first output on it, the failing card leaves its output unknown
+    TEST_CHECK(mixer_map_apply(&map, 50) == 1, "one group should fail");
+    const char* expected = "-q -s\nsset 'Master' 50%\nsset 'PCM' 25%\n"
+        "-q -c 1 -s\nsset 'Headphone' 40%\nsset 'Speaker' 50%\n"
+        "-q -c bad -s\nsset 'Line' 50%\n";
+    const char* log = take_log();
+    TEST_CHECK(strcmp(log, expected) == 0, "amixer calls:\n%s", log);
+    TEST_CHECK(map.outputs[0].applied == 50 && map.outputs[1].applied == 40 && map.outputs[2].applied == 25 &&
+               map.outputs[3].applied == 50, "applied levels");
+    TEST_CHECK(map.outputs[4].applied == VOLUME_UNKNOWN, "failed output has level %d", map.outputs[4].applied);
+
+    // Only the failed output is pending, nothing else is spawned
+    TEST_CHECK(mixer_map_pending(&map, 50) == 1, "pending after the apply");
+    TEST_CHECK(mixer_map_apply(&map, 50) == 1, "failed group again");
+    log = take_log();
+    TEST_CHECK(strcmp(log, "-q -c bad -s\nsset 'Line' 50%\n") == 0, "retry:\n%s", log);
+
+    // A new volume sends the outputs that move, one already at its new level is left out with its card
+    map.outputs[4].applied = 51;
+    TEST_CHECK(mixer_map_apply(&map, 51) == 0, "no failure");
+    log = take_log();
+    TEST_CHECK(strcmp(log, "-q -s\nsset 'Master' 51%\nsset 'PCM' 26%\n-q -c 1 -s\nsset 'Headphone' 41%\n"
+                      "sset 'Speaker' 51%\n") == 0, "partial apply:\n%s", log);
+    TEST_CHECK(mixer_map_apply(&map, 51) == 0 && take_log()[0] == '\0', "nothing pending, nothing spawned");
+    return 0;
+}
+
+// Build a configuration from a file with the two keys in the given order
+static int build_with(const char* first, const char* second)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/spc.conf", dir);
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        return -1;
+    }
+    fprintf(file, "%s\n%s\n", first, second);
+    fclose(file);
+    struct config_args args = {.config_path = path};
+    struct config cfg;
+    return config_build(&cfg, &args);
+}
+
+static int check_config(void)
+{
+    static const char* control = "mixer_control = PCM";
+    static const char* repeats = "mixer_outputs = Headphone, PCM:square";
+    static const char* valid = "mixer_outputs = Headphone, Master:square";
+    TEST_CHECK(build_with(control, repeats) != 0, "repeated control accepted, control first");
+    TEST_CHECK(build_with(repeats, control) != 0, "repeated control accepted, outputs first");
+    TEST_CHECK(build_with(control, valid) == 0, "valid outputs rejected, control first");
+    TEST_CHECK(build_with(valid, control) == 0, "valid outputs rejected, outputs first");
+    return 0;
+}
+
+int main(void)
+{
+    snprintf(dir, sizeof(dir), "/tmp/spc_mixer_map_%d", (int)getpid());
+    snprintf(log_path, sizeof(log_path), "%s/amixer.log", dir);
+    TEST_CHECK(mkdir(dir, 0700) == 0, "mkdir %s", dir);
+    char path[96];
+    snprintf(path, sizeof(path), "%s/amixer", dir);
+    FILE* fake = fopen(path, "w");
+    TEST_CHECK(fake != nullptr, "create %s", path);
+    fprintf(fake, "#!/bin/sh\n"
+                  "{ echo \"$*\"; cat; } >> '%s'\n"
+                  "[ \"$3\" != bad ]\n", log_path);
+    fclose(fake);
+    TEST_CHECK(chmod(path, 0700) == 0, "chmod %s", path);
+    char env_path[4096];
+    snprintf(env_path, sizeof(env_path), "%s:%s", dir, getenv("PATH") != nullptr ? getenv("PATH") : "/usr/bin:/bin");
+    setenv("PATH", env_path, 1);
+
+    const int failed = check_parse() || check_levels() || check_apply() || check_config();
+    remove(path);
+    remove(log_path);
+    snprintf(path, sizeof(path), "%s/spc.conf", dir);
+    remove(path);
+    rmdir(dir);
+    if (failed)
+    {
+        return 1;
+    }
+    printf("mixer_outputs parsing, level curves, pending outputs, card grouping and the config check passed\n");
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Equivalence test of the queue algorithms.
+// Queues from empty to several parallel chunks long are filled with random elements, then count_if, transform,
+// reduce and partition, sequential and parallel on 0 (one per CPU) to 8 threads, are compared with the same
+// operation done on a plain array. Partition must keep every element, put the matching ones first and call the
+// predicate once per element. Two threads also run the parallel variants at the same time, so one of them cannot
+// use the shared worker threads.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../TQueue.h"
+#include "test_util.h"
+
+#define ELEMENTS_MAX (QUEUE_PARALLEL_MIN * 8 + 5)
+
+static const size_t sizes[] = {0, 1, 2, 7, 1000, QUEUE_PARALLEL_MIN - 1, QUEUE_PARALLEL_MIN * 2 + 3, ELEMENTS_MAX};
+static const unsigned threads[] = {0, 1, 2, 3, 8};
+
+static atomic_ulong predicate_calls;
+
+// Queue and reference copy of one caller, static so that a failed check does not leak
+struct scratch
+{
+    struct TQueue queue;
+    TQueueElement reference[ELEMENTS_MAX];
+    bool seen[ELEMENTS_MAX];
+};
+
+static bool is_odd(const struct TQueueIterator* iter)
+{
+    atomic_fetch_add_explicit(&predicate_calls, 1, memory_order_relaxed);
+    return queue_iterator_value(iter).iData & 1;
+}
+
+static TQueueElement flip(const TQueueElement value)
+{
+    return (TQueueElement){.iData = (char)(value.iData ^ 0x55), .iSeq = value.iSeq, .iStamp = value.iStamp};
+}
+
+static long long add_data(const long long acc, const TQueueElement value)
+{
+    return acc + value.iData;
+}
+
+static long long add(const long long left, const long long right)
+{
+    return left + right;
+}
+
+static long long max_data(const long long acc, const TQueueElement value)
+{
+    return value.iData > acc ? value.iData : acc;
+}
+
+static long long max_of(const long long left, const long long right)
+{
+    return left > right ? left : right;
+}
+
+// Fill the queue and the reference array with the same random elements, iSeq is the original position
+static void fill(struct TQueue* queue, TQueueElement* reference, const size_t count, uint64_t* rng)
+{
+    queue_init(queue);
+    for (size_t i = 0; i < count; i++)
+    {
+        reference[i] = (TQueueElement){.iData = (char)test_rand_below(rng, 256), .iSeq = (unsigned int)i};
+        queue_push(queue, reference[i]);
+    }
+}
+
+static int compare(struct TQueue* queue, const TQueueElement* reference, const size_t count, const char* what)
+{
+    size_t index = 0;
+    struct TQueueIterator iter = queue_iterator_begin(queue);
+    for (bool valid = queue_iterator_is_valid(&iter); valid; valid = queue_iterator_to_next(&iter), index++)
+    {
+        TEST_CHECK(index < count, "%s: queue longer than %zu", what, count);
+        const TQueueElement value = queue_iterator_value(&iter);
+        TEST_CHECK(value.iData == reference[index].iData && value.iSeq == reference[index].iSeq,
+                   "%s: element %zu differs", what, index);
+    }
+    TEST_CHECK(index == count, "%s: %zu elements, expected %zu", what, index, count);
+    return 0;
+}
+
+// Matching elements first, the returned iterator at the first other one, every original element exactly once
+static int check_partition(struct TQueue* queue, const TQueueElement* reference, bool* seen, const size_t count,
+                           struct TQueueIterator split, const char* what)
+{
+    memset(seen, 0, count * sizeof(seen[0]));
+    size_t matched = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        matched += reference[i].iData & 1;
+    }
+    size_t index = 0;
+    bool found_split = false;
+    struct TQueueIterator iter = queue_iterator_begin(queue);
+    for (bool valid = queue_iterator_is_valid(&iter); valid; valid = queue_iterator_to_next(&iter), index++)
+    {
+        const TQueueElement value = queue_iterator_value(&iter);
+        TEST_CHECK(value.iSeq < count && !seen[value.iSeq] && value.iData == reference[value.iSeq].iData,
+                   "%s: element %zu lost or duplicated", what, index);
+        seen[value.iSeq] = true;
+        TEST_CHECK((index < matched) == (bool)(value.iData & 1), "%s: element %zu on the wrong side", what, index);
+        if (index == matched)
+        {
+            TEST_CHECK(split.iQueue == iter.iQueue && split.iActual == iter.iActual,
+                       "%s: returned iterator is not at element %zu", what, matched);
+            found_split = true;
+        }
+    }
+    TEST_CHECK(index == count, "%s: %zu elements, expected %zu", what, index, count);
+    TEST_CHECK(found_split || !queue_iterator_is_valid(&split), "%s: iterator valid with every element matching",
+               what);
+    return 0;
+}
+
+// Every algorithm on one queue size and thread count, returns 0 when all match the array. The predicate calls
+// are only counted without a concurrent caller
+static int check(struct scratch* scratch, const size_t count, const unsigned thread_count, const bool alone,
+                 uint64_t* rng, double* elements)
+{
+    TQueueElement* reference = scratch->reference;
+    bool* seen = scratch->seen;
+    struct TQueue* queue = &scratch->queue;
+    char what[64];
+    fill(queue, reference, count, rng);
+
+    size_t odd = 0;
+    long long sum = 0;
+    long long top = -1000;
+    for (size_t i = 0; i < count; i++)
+    {
+        odd += reference[i].iData & 1;
+        sum += reference[i].iData;
+        top = reference[i].iData > top ? reference[i].iData : top;
+    }
+    snprintf(what, sizeof(what), "%zu elements, %u threads", count, thread_count);
+    TEST_CHECK(queue_count_if(queue_iterator_begin(queue), is_odd) == odd, "%s: count_if", what);
+    TEST_CHECK(queue_count_if_parallel(queue, is_odd, thread_count) == odd, "%s: count_if_parallel", what);
+    TEST_CHECK(queue_reduce(queue_iterator_begin(queue), 0, add_data) == sum, "%s: reduce", what);
+    TEST_CHECK(queue_reduce_parallel(queue, 0, add_data, add, thread_count) == sum, "%s: reduce_parallel", what);
+    TEST_CHECK(queue_reduce_parallel(queue, -1000, max_data, max_of, thread_count) == top, "%s: reduce_parallel max",
+               what);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        reference[i] = flip(reference[i]);
+    }
+    queue_transform_parallel(queue, flip, thread_count);
+    if (compare(queue, reference, count, "transform_parallel") != 0)
+    {
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        reference[i] = flip(reference[i]);
+    }
+    queue_transform(queue_iterator_begin(queue), flip);
+    if (compare(queue, reference, count, "transform") != 0)
+    {
+        return 1;
+    }
+
+    atomic_store(&predicate_calls, 0);
+    struct TQueueIterator split = queue_partition_parallel(queue, is_odd, thread_count);
+    TEST_CHECK(!alone || atomic_load(&predicate_calls) == count, "%s: predicate called %lu times", what,
+               atomic_load(&predicate_calls));
+    if (check_partition(queue, reference, seen, count, split, "partition_parallel") != 0)
+    {
+        return 1;
+    }
+    queue_transform(queue_iterator_begin(queue), flip);
+    for (size_t i = 0; i < count; i++)
+    {
+        reference[i] = flip(reference[i]);
+    }
+    split = queue_partition(queue_iterator_begin(queue), is_odd);
+    if (check_partition(queue, reference, seen, count, split, "partition") != 0)
+    {
+        return 1;
+    }
+    queue_destroy(queue);
+    *elements += 6.0 * (double)count;
+    return 0;
+}
+
+// Second caller running the parallel variants while the main thread does the same
+static void* concurrent(void* arg)
+{
+    static struct scratch scratch;
+    uint64_t rng = test_seed() + 1;
+    const unsigned long rounds = *(const unsigned long*)arg;
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        double elements = 0.0;
+        if (check(&scratch, QUEUE_PARALLEL_MIN * 4, 4, false, &rng, &elements) != 0)
+        {
+            return (void*)1;
+        }
+    }
+    return nullptr;
+}
+
+int main(void)
+{
+    static struct scratch scratch;
+    uint64_t rng = test_seed();
+    const unsigned long rounds = test_scaled(2);
+    double elements = 0.0;
+    const double start = test_now();
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+            {
+                if (check(&scratch, sizes[s], threads[t], true, &rng, &elements) != 0)
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+    const double seconds = test_now() - start;
+    printf("count_if, transform, reduce and partition match the array, sequential and on 0 to 8 threads\n");
+
+    pthread_t thread;
+    double concurrent_elements = 0.0;
+    TEST_CHECK(pthread_create(&thread, nullptr, concurrent, (void*)&rounds) == 0, "second caller");
+    for (unsigned long round = 0; round < rounds; round++)
+    {
+        TEST_CHECK(check(&scratch, QUEUE_PARALLEL_MIN * 4, 4, false, &rng, &concurrent_elements) == 0, "concurrent callers");
+    }
+    void* failed = nullptr;
+    pthread_join(thread, &failed);
+    TEST_CHECK(failed == nullptr, "second caller failed");
+    printf("two concurrent callers match the array\n");
+    return test_throughput("algorithm elements", elements, seconds, "SPC_TEST_MIN_ALGORITHMS_MOPS", 2.0);
+}
@@ -0,0 +1,231 @@
+// Randomized push/pop fuzzing of TQueue against a reference model.
+// Every configuration (unbounded, and every overflow policy with several capacities) runs a long random mix of
+// operations on a TQueue and on a plain ring buffer implementing the documented semantics, and compares every
+// result. Bounded queues are also resized, shrinking drops the surplus as the policy says. The contents are compared
+// through the iterators and the queue algorithms now and then.
+
+#include <stdbool.h>
+#include <string.h>
+#include "../TQueue.h"
+#include "test_util.h"
+
+#define MODEL_MAX 4096 // Unbounded runs keep the model below this size
+
+// Reference queue, a ring buffer
+struct model
+{
+    TQueueElement items[MODEL_MAX];
+    size_t head;
+    size_t count;
+    size_t capacity; // 0 for unbounded
+    enum TQueueOverflowPolicy policy;
+    size_t dropped;
+};
+
+static TQueueElement* model_at(struct model* model, const size_t index)
+{
+    return &model->items[(model->head + index) % MODEL_MAX];
+}
+
+static bool model_pop(struct model* model)
+{
+    if (model->count == 0)
+    {
+        return false;
+    }
+    model->head = (model->head + 1) % MODEL_MAX;
+    model->count--;
+    return true;
+}
+
+static bool model_push(struct model* model, const TQueueElement value)
+{
+    if (model->capacity != 0 && model->count >= model->capacity)
+    {
+        switch (model->policy)
+        {
+        case QUEUE_OVERFLOW_BLOCK:
+            return false;
+        case QUEUE_OVERFLOW_DROP_NEWEST:
+            model->dropped++;
+            return false;
+        case QUEUE_OVERFLOW_COALESCE:
+            *model_at(model, model->count - 1) = value;
+            model->dropped++;
+            return true;
+        case QUEUE_OVERFLOW_DROP_OLDEST:
+            model_pop(model);
+            model->dropped++;
+            break;
+        }
+    }
+    *model_at(model, model->count) = value;
+    model->count++;
+    return true;
+}
+
+// Capacity change, the surplus is dropped as the policy says (all but a blocking queue)
+static size_t model_set_capacity(struct model* model, const size_t capacity)
+{
+    model->capacity = capacity;
+    if (capacity == 0 || model->count <= capacity || model->policy == QUEUE_OVERFLOW_BLOCK)
+    {
+        return 0;
+    }
+    const size_t dropped = model->count - capacity;
+    if (model->policy != QUEUE_OVERFLOW_DROP_NEWEST)
+    {
+        model->head = (model->head + dropped) % MODEL_MAX;
+    }
+    model->count = capacity;
+    model->dropped += dropped;
+    return dropped;
+}
+
+static bool same(const TQueueElement a, const TQueueElement b)
+{
+    return a.iData == b.iData && a.iSeq == b.iSeq && a.iStamp.tv_sec == b.iStamp.tv_sec &&
+        a.iStamp.tv_nsec == b.iStamp.tv_nsec;
+}
+
+static bool is_odd(const struct TQueueIterator* iter)
+{
+    return queue_iterator_value(iter).iData & 1;
+}
+
+static long long add_seq(const long long acc, const TQueueElement value)
+{
+    return acc + value.iSeq;
+}
+
+// Compare the whole queue with the model through the iterators and the algorithms
+static int compare_contents(struct TQueue* queue, struct model* model)
+{
+    size_t index = 0;
+    size_t odd = 0;
+    long long seq_sum = 0;
+    struct TQueueIterator iter = queue_iterator_begin(queue);
+    for (bool valid = queue_iterator_is_valid(&iter); valid; valid = queue_iterator_to_next(&iter))
+    {
+        TEST_CHECK(index < model->count, "queue longer than the model (%zu)", model->count);
+        const TQueueElement expected = *model_at(model, index);
+        TEST_CHECK(same(queue_iterator_value(&iter), expected), "element %zu differs", index);
+        odd += expected.iData & 1;
+        seq_sum += expected.iSeq;
+        index++;
+    }
+    TEST_CHECK(index == model->count, "queue has %zu elements, model %zu", index, model->count);
+    TEST_CHECK(queue_count_if(queue_iterator_begin(queue), is_odd) == odd, "count_if differs");
+    TEST_CHECK(queue_reduce(queue_iterator_begin(queue), 0, add_seq) == seq_sum, "reduce differs");
+    return 0;
+}
+
+// One configuration, returns 0 when the queue matched the model throughout
+static int fuzz(const size_t capacity, const enum TQueueOverflowPolicy policy, const unsigned long ops,
+                uint64_t* rng, unsigned long* done)
+{
+    static struct model model;
+    memset(&model, 0, sizeof(model));
+    model.capacity = capacity;
+    model.policy = policy;
+    struct TQueue queue;
+    queue_init_bounded(&queue, capacity, policy);
+
+    unsigned int seq = 0;
+    for (unsigned long op = 0; op < ops; op++)
+    {
+        const unsigned int roll = test_rand_below(rng, 1000);
+        // Unbounded runs drift towards MODEL_MAX unless pops win once the queue is large
+        const unsigned int push_share = capacity == 0 && model.count > MODEL_MAX / 2 ? 400 : 520;
+        if (roll < push_share)
+        {
+            const TQueueElement value = {
+                .iData = (char)test_rand(rng), .iSeq = ++seq,
+                .iStamp = {.tv_sec = (time_t)op, .tv_nsec = (long)test_rand_below(rng, 1000000000)}
+            };
+            const bool expected = model_push(&model, value);
+            TEST_CHECK(queue_push(&queue, value) == expected, "push %lu", op);
+        }
+        else if (roll < 960)
+        {
+            const bool expected = model_pop(&model);
+            TEST_CHECK(queue_pop(&queue) == expected, "pop %lu", op);
+        }
+        else if (roll < 975)
+        {
+            TQueueElement front = {0};
+            TQueueElement back = {0};
+            const bool has = model.count > 0;
+            TEST_CHECK(queue_front(&queue, &front) == has && queue_back(&queue, &back) == has, "front/back %lu", op);
+            if (has)
+            {
+                TEST_CHECK(same(front, *model_at(&model, 0)), "front %lu", op);
+                TEST_CHECK(same(back, *model_at(&model, model.count - 1)), "back %lu", op);
+            }
+        }
+        else if (roll < 985 && capacity != 0)
+        {
+            // Grow or shrink a bounded queue around its starting capacity
+            const size_t resized = 1 + test_rand_below(rng, (unsigned int)capacity * 2);
+            const size_t expected = model_set_capacity(&model, resized);
+            TEST_CHECK(queue_set_capacity(&queue, resized) == expected, "set_capacity %zu at %lu", resized, op);
+            TEST_CHECK(queue_capacity(&queue) == resized, "capacity %lu", op);
+        }
+        else if (roll < 990)
+        {
+            // Preallocation must never change what the queue holds
+            const size_t reserve = test_rand_below(rng, 2) ? capacity : test_rand_below(rng, 16);
+            TEST_CHECK(queue_reserve(&queue, reserve), "reserve %lu", op);
+        }
+        else if (roll < 999)
+        {
+            if (compare_contents(&queue, &model) != 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            // Start over, capacity and policy survive queue_destroy
+            queue_destroy(&queue);
+            queue_set_policy(&queue, policy);
+            model.head = model.count = model.dropped = 0;
+        }
+        TEST_CHECK(queue_size(&queue) == model.count, "size %lu", op);
+        TEST_CHECK(queue_is_empty(&queue) == (model.count == 0), "is_empty %lu", op);
+        TEST_CHECK(queue_is_full(&queue) == (model.capacity != 0 && model.count >= model.capacity), "is_full %lu", op);
+        TEST_CHECK(queue_dropped(&queue) == model.dropped, "dropped %lu", op);
+    }
+    const int result = compare_contents(&queue, &model);
+    queue_destroy(&queue);
+    *done += ops;
+    return result;
+}
+
+int main(void)
+{
+    static const char* policy_names[] = {"block", "drop_oldest", "drop_newest", "coalesce"};
+    static const size_t capacities[] = {1, 7, 64};
+    uint64_t rng = test_seed();
+    const unsigned long ops = test_scaled(500000);
+    unsigned long done = 0;
+    const double start = test_now();
+
+    printf("unbounded, %lu operations\n", ops);
+    if (fuzz(0, QUEUE_OVERFLOW_BLOCK, ops, &rng, &done) != 0)
+    {
+        return 1;
+    }
+    for (int policy = QUEUE_OVERFLOW_BLOCK; policy <= QUEUE_OVERFLOW_COALESCE; policy++)
+    {
+        for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+        {
+            printf("%s, capacity %zu, %lu operations\n", policy_names[policy], capacities[i], ops);
+            if (fuzz(capacities[i], (enum TQueueOverflowPolicy)policy, ops, &rng, &done) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    return test_throughput("queue operations", (double)done, test_now() - start, "SPC_TEST_MIN_QUEUE_MOPS", 3.5);
+}
@@ -0,0 +1,219 @@
+// Test of the serial I/O engine on a pseudo terminal.
+// The engine is attached to the slave side like to the device's tty, the test plays the device on the master side.
+// Both backends must pass bytes through unchanged in both directions, keep the order of writes queued in one
+// chain and across chains longer than the write slots, return 0 when a waiting read times out, and report a write
+// that failed once the device is gone on the next write or flush. serial_io_wake from another thread must end a
+// wait, and a wake made while nobody waits must end the next one. The syscall counters must show one
+// io_uring_enter per chain of writes and fewer syscalls per sample than the plain backend.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "../serial_io.h"
+#include "test_util.h"
+
+#define ROUND_TRIPS 200
+
+static int device = -1; // Master side, the test plays the device here
+static int port = -1; // Slave side, the port the engine is attached to
+
+static int open_pty(void)
+{
+    device = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    TEST_CHECK(device >= 0 && grantpt(device) == 0 && unlockpt(device) == 0, "pseudo terminal");
+    port = open(ptsname(device), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    TEST_CHECK(port >= 0, "open %s", ptsname(device));
+    // Raw like UART_Init leaves the port, no echo and no line editing
+    struct termios raw;
+    TEST_CHECK(tcgetattr(port, &raw) == 0, "tcgetattr");
+    cfmakeraw(&raw);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    TEST_CHECK(tcsetattr(port, TCSANOW, &raw) == 0, "tcsetattr");
+    return 0;
+}
+
+// Read exactly len bytes sent to the device, returns 0 on success and 1 after a second without data
+static int device_read(char* dst, const size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        struct pollfd ready = {.fd = device, .events = POLLIN};
+        if (poll(&ready, 1, 1000) <= 0)
+        {
+            return 1;
+        }
+        const ssize_t n = read(device, dst + got, len - got);
+        if (n <= 0)
+        {
+            return 1;
+        }
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+// Collect exactly len bytes through the engine, returns 0 on success
+static int engine_read(char* dst, const size_t len)
+{
+    size_t got = 0;
+    for (int tries = 0; got < len && tries < 50; tries++)
+    {
+        const ssize_t n = serial_io_read(dst + got, len - got, 1);
+        if (n < 0)
+        {
+            return 1;
+        }
+        got += (size_t)n;
+    }
+    return got == len ? 0 : 1;
+}
+
+// Reap write completions until the counter reaches writes, the io_uring backend only counts them when reaping
+static unsigned long settle_writes(const unsigned long writes)
+{
+    for (int tries = 0; serial_io_get_stats().writes < writes && tries < 100; tries++)
+    {
+        serial_io_flush();
+        usleep(1000);
+    }
+    return serial_io_get_stats().writes;
+}
+
+static void* wake_later(void* arg)
+{
+    (void)arg;
+    usleep(100000);
+    serial_io_wake();
+    return nullptr;
+}
+
+// Time a waiting read that nothing arrives for, returns the seconds waited or -1 when the read did not return 0
+static double timed_wait(void)
+{
+    char got[16];
+    const double start = test_now();
+    return serial_io_read(got, sizeof(got), 1) == 0 ? test_now() - start : -1.0;
+}
+
+static int check_backend(const bool uring, double* syscalls_per_sample)
+{
+    if (open_pty() != 0)
+    {
+        return 1;
+    }
+    TEST_CHECK(serial_io_init(port, uring) == 0, "init");
+    const char* backend = serial_io_backend();
+    if (uring && strcmp(backend, "io_uring") != 0)
+    {
+        printf("io_uring not available, skipped\n");
+        serial_io_close();
+        close(port);
+        close(device);
+        *syscalls_per_sample = 0.0;
+        return 0;
+    }
+    serial_io_set_coalesce(0);
+    serial_io_set_wait_timeout(100);
+
+    // Device to host
+    char got[512];
+    TEST_CHECK(write(device, "1023\n7\n", 7) == 7, "device write");
+    TEST_CHECK(engine_read(got, 7) == 0 && memcmp(got, "1023\n7\n", 7) == 0, "%s: inbound bytes", backend);
+
+    // Host to device, three writes queued before one flush. io_uring sends them as one linked chain, "a", "bc" and
+    // three slots of the 40 byte message
+    static const char long_message[] = "0123456789abcdefghijklmnopqrstuvwxyzABCD";
+    struct serial_io_stats before = serial_io_get_stats();
+    TEST_CHECK(serial_io_write("a", 1) == 0 && serial_io_write("bc", 2) == 0 &&
+               serial_io_write(long_message, 40) == 0 && serial_io_flush() == 0, "%s: writes", backend);
+    struct serial_io_stats after = serial_io_get_stats();
+    const unsigned long chain_syscalls = after.syscalls - before.syscalls;
+    TEST_CHECK(chain_syscalls == (uring ? 1 : 3), "%s: %lu syscalls for three writes", backend, chain_syscalls);
+    TEST_CHECK(device_read(got, 43) == 0 && memcmp(got, "abc", 3) == 0 && memcmp(got + 3, long_message, 40) == 0,
+               "%s: outbound bytes", backend);
+    const unsigned long writes = settle_writes(before.writes + (uring ? 5 : 3)) - before.writes;
+    TEST_CHECK(writes == (uring ? 5 : 3), "%s: %lu completed writes", backend, writes);
+
+    // More writes than slots, the engine starts new chains and must keep the order
+    char expected[400];
+    size_t expected_len = 0;
+    for (int i = 0; i < 30; i++)
+    {
+        char message[16];
+        const int len = snprintf(message, sizeof(message), "message %02d\n", i);
+        TEST_CHECK(serial_io_write(message, (size_t)len) == 0, "%s: write %d", backend, i);
+        memcpy(expected + expected_len, message, (size_t)len);
+        expected_len += (size_t)len;
+    }
+    TEST_CHECK(serial_io_flush() == 0, "%s: flush", backend);
+    TEST_CHECK(device_read(got, expected_len) == 0 && memcmp(got, expected, expected_len) == 0,
+               "%s: order across chains", backend);
+
+    // A waiting read with nothing to take ends after the timeout with 0, not an error
+    serial_io_set_wait_timeout(50);
+    double waited = timed_wait();
+    TEST_CHECK(waited >= 0.04 && waited < 1.0, "%s: idle read waited %.3f s", backend, waited);
+
+    // A wake made while nobody waits ends the next wait at once, also when it completed the wake read io_uring
+    // left posted by the timed out wait. A wake from another thread ends the wait long before the timeout
+    serial_io_set_wait_timeout(3000);
+    serial_io_wake();
+    usleep(10000);
+    waited = timed_wait();
+    TEST_CHECK(waited >= 0.0 && waited < 0.5, "%s: read after a wake waited %.3f s", backend, waited);
+    pthread_t waker;
+    TEST_CHECK(pthread_create(&waker, nullptr, wake_later, nullptr) == 0, "waker thread");
+    waited = timed_wait();
+    pthread_join(waker, nullptr);
+    TEST_CHECK(waited >= 0.05 && waited < 1.0, "%s: woken read waited %.3f s", backend, waited);
+    TEST_CHECK(serial_io_get_stats().wakes == 2, "%s: %lu wakes", backend, serial_io_get_stats().wakes);
+    serial_io_set_wait_timeout(100);
+
+    // Samples answered with an echo like the main loop does, the echo goes out with the next read
+    before = serial_io_get_stats();
+    for (int i = 0; i < ROUND_TRIPS; i++)
+    {
+        TEST_CHECK(write(device, "512\n", 4) == 4, "device write %d", i);
+        TEST_CHECK(serial_io_write("50\n", 3) == 0, "%s: echo %d", backend, i);
+        TEST_CHECK(engine_read(got, 4) == 0 && memcmp(got, "512\n", 4) == 0, "%s: sample %d", backend, i);
+        serial_io_flush();
+        TEST_CHECK(device_read(got, 3) == 0 && memcmp(got, "50\n", 3) == 0, "%s: echo %d lost", backend, i);
+    }
+    after = serial_io_get_stats();
+    *syscalls_per_sample = (double)(after.syscalls - before.syscalls) / ROUND_TRIPS;
+    printf("%s: bytes and order kept, %lu syscalls per chain, %.2f syscalls per sample\n", backend, chain_syscalls,
+           *syscalls_per_sample);
+
+    // The device goes away, the failed write is reported by a later write or flush
+    close(device);
+    bool reported = false;
+    for (int tries = 0; tries < 200 && !reported; tries++)
+    {
+        reported = serial_io_write("x", 1) != 0 || serial_io_flush() != 0;
+        usleep(1000);
+    }
+    TEST_CHECK(reported, "%s: write to a closed device not reported", backend);
+    serial_io_close();
+    close(port);
+    return 0;
+}
+
+int main(void)
+{
+    double plain = 0.0;
+    double uring = 0.0;
+    if (check_backend(false, &plain) != 0 || check_backend(true, &uring) != 0)
+    {
+        return 1;
+    }
+    TEST_CHECK(uring == 0.0 || uring < plain, "io_uring %.2f syscalls per sample, plain %.2f", uring, plain);
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Seqlock and ownership test of the shared memory telemetry.
+// The writer thread (like the main loop) publishes updates that set every value to the same number, while reader
+// threads take snapshots through the reader library. A snapshot mixing two updates fails the test. Meanwhile a
+// second process must fail to open the same name. Afterwards a reader must see the segment closed and a new
+// reader must fail to open it. Finally a segment left by a dead process is replaced, another program's object is
+// left alone, and closing does not unlink a name another instance took over.
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../telemetry.h"
+#include "../telemetry_reader.h"
+#include "test_util.h"
+
+#define WRITERS 1
+#define READERS 2
+
+struct shared
+{
+    char name[64];
+    unsigned long updates; // Per writer
+    atomic_int writing; // Writers still running
+    atomic_int writer_ids;
+    atomic_ulong snapshots;
+    atomic_ulong torn;
+    atomic_ulong failed;
+};
+
+static void* write_values(void* arg)
+{
+    struct shared* shared = arg;
+    const uint64_t id = (uint64_t)atomic_fetch_add(&shared->writer_ids, 1);
+    for (unsigned long i = 1; i <= shared->updates; i++)
+    {
+        telemetry_begin();
+        const uint64_t value = i * WRITERS + id;
+        for (int field = 0; field < TELEMETRY_FIELD_COUNT; field++)
+        {
+            telemetry_set((enum telemetry_field)field, value);
+        }
+        telemetry_end();
+    }
+    atomic_fetch_sub(&shared->writing, 1);
+    return nullptr;
+}
+
+static void* read_values(void* arg)
+{
+    struct shared* shared = arg;
+    struct telemetry_reader reader;
+    if (telemetry_reader_open(&reader, shared->name) != 0)
+    {
+        atomic_fetch_add(&shared->failed, 1);
+        return nullptr;
+    }
+    struct telemetry_snapshot snapshot;
+    while (atomic_load(&shared->writing) > 0)
+    {
+        if (!telemetry_reader_read(&reader, &snapshot))
+        {
+            atomic_fetch_add(&shared->failed, 1);
+            continue;
+        }
+        for (int field = 1; field < TELEMETRY_FIELD_COUNT; field++)
+        {
+            if (snapshot.values[field] != snapshot.values[0])
+            {
+                atomic_fetch_add(&shared->torn, 1);
+                break;
+            }
+        }
+        atomic_fetch_add(&shared->snapshots, 1);
+    }
+    telemetry_reader_close(&reader);
+    return nullptr;
+}
+
+// Second process that tries to publish under the name once it reads a byte from go, it exits with 0 on success
+static pid_t start_second_instance(const char* name, int* go)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        return -1;
+    }
+    const pid_t child = fork();
+    if (child == 0)
+    {
+        char byte;
+        close(fds[1]);
+        _exit(read(fds[0], &byte, 1) == 1 && telemetry_open(name) == 0 ? 0 : 1);
+    }
+    close(fds[0]);
+    *go = fds[1];
+    return child;
+}
+
+// Create an object under the name as another process would have left it
+static int plant(const char* name, const uint32_t magic, const pid_t pid)
+{
+    const int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    TEST_CHECK(fd >= 0, "create %s", name);
+    TEST_CHECK(ftruncate(fd, sizeof(struct telemetry_segment)) == 0, "size %s", name);
+    struct telemetry_segment* planted =
+        mmap(nullptr, sizeof(struct telemetry_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    TEST_CHECK(planted != MAP_FAILED, "map %s", name);
+    planted->version = TELEMETRY_VERSION;
+    planted->field_count = TELEMETRY_FIELD_COUNT;
+    planted->magic = magic;
+    planted->pid = pid;
+    atomic_store(&planted->open, 1);
+    munmap(planted, sizeof(struct telemetry_segment));
+    return 0;
+}
+
+// Stale, foreign and taken-over objects under the name
+static int check_ownership(const char* name)
+{
+    // Left open by a process that is gone
+    const pid_t dead = fork();
+    if (dead == 0)
+    {
+        _exit(0);
+    }
+    waitpid(dead, nullptr, 0);
+    TEST_CHECK(plant(name, TELEMETRY_MAGIC, dead) == 0, "stale segment");
+    TEST_CHECK(telemetry_open(name) == 0, "stale segment not replaced");
+    struct telemetry_reader reader;
+    TEST_CHECK(telemetry_reader_open(&reader, name) == 0 && reader.segment->pid == getpid(), "replaced segment");
+    telemetry_reader_close(&reader);
+
+    // Taken over while open, closing must not unlink the newcomer
+    shm_unlink(name);
+    TEST_CHECK(plant(name, TELEMETRY_MAGIC, getppid()) == 0, "newcomer");
+    telemetry_close();
+    TEST_CHECK(telemetry_reader_open(&reader, name) == 0, "newcomer unlinked by the old publisher");
+    telemetry_reader_close(&reader);
+    shm_unlink(name);
+
+    // Some other program's object
+    TEST_CHECK(plant(name, 0, dead) == 0, "foreign object");
+    TEST_CHECK(telemetry_open(name) != 0, "foreign object taken over");
+    const int fd = shm_open(name, O_RDONLY, 0);
+    TEST_CHECK(fd >= 0, "foreign object unlinked");
+    close(fd);
+    shm_unlink(name);
+    return 0;
+}
+
+int main(void)
+{
+    static struct shared shared;
+    snprintf(shared.name, sizeof(shared.name), "/spc_telemetry_test_%d", (int)getpid());
+    shared.updates = test_scaled(2000000);
+    atomic_store(&shared.writing, WRITERS);
+    int go = -1;
+    const pid_t second = start_second_instance(shared.name, &go);
+    TEST_CHECK(second > 0, "second instance");
+    TEST_CHECK(telemetry_open(shared.name) == 0, "open %s", shared.name);
+    int status = 0;
+    TEST_CHECK(write(go, "", 1) == 1 && waitpid(second, &status, 0) == second, "second instance");
+    close(go);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1, "second instance attached to a live segment");
+
+    const double start = test_now();
+    pthread_t readers[READERS];
+    pthread_t writers[WRITERS];
+    for (int i = 0; i < READERS; i++)
+    {
+        TEST_CHECK(pthread_create(&readers[i], nullptr, read_values, &shared) == 0, "reader");
+    }
+    for (int i = 0; i < WRITERS; i++)
+    {
+        TEST_CHECK(pthread_create(&writers[i], nullptr, write_values, &shared) == 0, "writer");
+    }
+    for (int i = 0; i < WRITERS; i++)
+    {
+        pthread_join(writers[i], nullptr);
+    }
+    for (int i = 0; i < READERS; i++)
+    {
+        pthread_join(readers[i], nullptr);
+    }
+    const double elapsed = test_now() - start;
+
+    struct telemetry_reader reader;
+    struct telemetry_snapshot snapshot;
+    TEST_CHECK(telemetry_reader_open(&reader, shared.name) == 0, "reopen");
+    TEST_CHECK(telemetry_reader_read(&reader, &snapshot), "final read");
+    TEST_CHECK(snapshot.sequence == 2 * WRITERS * shared.updates, "sequence %u after %lu updates", snapshot.sequence,
+               WRITERS * shared.updates);
+    telemetry_close();
+    TEST_CHECK(!telemetry_reader_read(&reader, &snapshot), "read after the publisher closed");
+    telemetry_reader_close(&reader);
+    TEST_CHECK(telemetry_reader_open(&reader, shared.name) != 0, "open after unlink");
+    if (check_ownership(shared.name) != 0)
+    {
+        return 1;
+    }
+
+    printf("%lu snapshots, %lu torn, %lu failed\n", atomic_load(&shared.snapshots), atomic_load(&shared.torn),
+           atomic_load(&shared.failed));
+    TEST_CHECK(atomic_load(&shared.torn) == 0, "torn snapshots");
+    TEST_CHECK(atomic_load(&shared.failed) == 0, "failed reads");
+    return test_throughput("telemetry updates", (double)(WRITERS * shared.updates), elapsed,
+                           "SPC_TEST_MIN_TELEMETRY_MOPS", 4.5);
+}
@@ -0,0 +1,125 @@
+// Test of the TX scheduler between the host and the device.
+// Checks that control messages overtake waiting volume echoes without splitting a message already being sent,
+// that a newer volume echo replaces the waiting one, and that the paced drain never sends more than the budget
+// plus what the rate allows since the start, while still reaching about the configured rate.
+
+#include <stdbool.h>
+#include <string.h>
+#include "../tx_sched.h"
+#include "test_util.h"
+
+#define WIRE_MAX 65536
+
+static char wire[WIRE_MAX]; // Everything the sink was given
+static size_t wire_len;
+static size_t largest_write;
+static double wire_start; // test_now() when pacing started
+static double rate_limit; // Bytes per second of the pacing test, 0 outside of it
+static double budget_limit;
+static bool over_rate;
+
+static int capture(const char* data, const size_t len)
+{
+    if (wire_len + len > WIRE_MAX)
+    {
+        return 1;
+    }
+    memcpy(wire + wire_len, data, len);
+    wire_len += len;
+    largest_write = len > largest_write ? len : largest_write;
+    if (rate_limit > 0.0 && (double)wire_len > budget_limit + rate_limit * (test_now() - wire_start) + 1.0)
+    {
+        over_rate = true;
+    }
+    return 0;
+}
+
+// Send what is left, then wait for a full bucket
+static void wire_reset(void)
+{
+    tx_finish(1000);
+    wire_len = 0;
+    largest_write = 0;
+    const struct timespec fill = {0, 20000000};
+    nanosleep(&fill, nullptr);
+}
+
+static int priority_and_supersede(void)
+{
+    // A slow drain, four bytes at once
+    tx_configure(1000, 4);
+    wire_reset();
+    TEST_CHECK(tx_send(TX_PRIORITY_VOLUME, "12\n", 3), "first echo");
+    TEST_CHECK(tx_pump() == 0, "pump");
+    // "12\n" is being sent and one byte of the bucket is left. Echoes queued meanwhile collapse into the newest
+    for (int volume = 20; volume < 60; volume++)
+    {
+        char echo[4] = {(char)('0' + volume / 10), (char)('0' + volume % 10), '\n'};
+        TEST_CHECK(tx_send(TX_PRIORITY_VOLUME, echo, 3), "echo %d", volume);
+    }
+    TEST_CHECK(tx_send(TX_PRIORITY_CONTROL, "r\n", 2), "control");
+    TEST_CHECK(tx_finish(1000) == 0, "finish");
+    wire[wire_len] = '\0';
+    TEST_CHECK(strcmp(wire, "12\nr\n59\n") == 0, "wire \"%s\"", wire);
+    TEST_CHECK(largest_write <= 4, "write of %zu bytes over the budget", largest_write);
+    const struct tx_stats stats = tx_get_stats();
+    TEST_CHECK(stats.superseded == 39, "%lu superseded", stats.superseded);
+    printf("control overtakes echoes, 39 echoes superseded\n");
+    return 0;
+}
+
+static int control_is_kept(void)
+{
+    // Control messages are never dropped, a full queue refuses the next one
+    tx_configure(1000, 1);
+    wire_reset();
+    int queued = 0;
+    while (tx_send(TX_PRIORITY_CONTROL, "w", 1))
+    {
+        queued++;
+    }
+    TEST_CHECK(queued == TX_QUEUE_MESSAGES, "%d control messages queued", queued);
+    TEST_CHECK(tx_finish(1000) == 0, "finish");
+    TEST_CHECK(wire_len == TX_QUEUE_MESSAGES, "%zu control bytes sent", wire_len);
+    TEST_CHECK(!tx_send(TX_PRIORITY_CONTROL, "too long message", 16), "message longer than TX_MESSAGE_MAX");
+    return 0;
+}
+
+static int pacing(void)
+{
+    const unsigned int rate = 20000;
+    const unsigned int budget = 16;
+    const size_t total = test_scaled(4000);
+    tx_configure(rate, budget);
+    wire_reset();
+    rate_limit = rate;
+    budget_limit = budget;
+    wire_start = test_now();
+    size_t queued = 0;
+    while (wire_len < total)
+    {
+        while (queued < total && tx_send(TX_PRIORITY_CONTROL, "abcd", 4))
+        {
+            queued += 4;
+        }
+        TEST_CHECK(tx_pump() == 0, "pump");
+    }
+    const double elapsed = test_now() - wire_start;
+    rate_limit = 0.0;
+    const double achieved = (double)wire_len / elapsed;
+    printf("paced %zu bytes in %.3f s, %.0f B/s (rate %u B/s, budget %u), largest write %zu\n", wire_len, elapsed,
+           achieved, rate, budget, largest_write);
+    TEST_CHECK(!over_rate, "more bytes than the rate and budget allow");
+    TEST_CHECK(largest_write <= budget, "write of %zu bytes over the budget", largest_write);
+    TEST_CHECK(achieved > rate * 0.5, "drain far below the rate");
+    return 0;
+}
+
+int main(void)
+{
+    tx_set_sink(capture);
+    int failed = priority_and_supersede();
+    failed |= control_is_kept();
+    failed |= pacing();
+    return failed;
+}
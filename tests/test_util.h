@@ -0,0 +1,98 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Shared helpers of the test programs.
+// A test prints what it checked and exits with a nonzero code on the first failure. Run lengths and throughput
+// floors come from environment variables so that slow machines and sanitizer builds can lower them:
+//   SPC_TEST_SCALE      multiplies the number of operations of every test (default 1)
+//   SPC_TEST_SEED       seed of the pseudo-random generators (default 1)
+//   SPC_TEST_MIN_*      throughput floor of one test, 0 disables it
+// The default floors are about half the rates measured in the default AddressSanitizer build on one CPU.
+// ThreadSanitizer slows the tests down up to eight times, so its builds divide them by eight.
+
+#if defined(__SANITIZE_THREAD__)
+#define TEST_FLOOR_SCALE 0.125
+#else
+#define TEST_FLOOR_SCALE 1.0
+#endif
+
+// Fail the calling test function (which returns int) when cond does not hold
+#define TEST_CHECK(cond, ...)                                               \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond);          \
+            printf(__VA_ARGS__);                                            \
+            printf("\n");                                                   \
+            return 1;                                                       \
+        }                                                                   \
+    }                                                                       \
+    while (0)
+
+// Monotonic time in seconds
+static inline double test_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Numeric environment variable, fallback when it is not set
+static inline double test_env(const char* name, const double fallback)
+{
+    const char* value = getenv(name);
+    return value != nullptr && value[0] != '\0' ? strtod(value, nullptr) : fallback;
+}
+
+// Operation count scaled by SPC_TEST_SCALE
+static inline unsigned long test_scaled(const unsigned long count)
+{
+    const double scaled = (double)count * test_env("SPC_TEST_SCALE", 1.0);
+    return scaled < 1.0 ? 1 : (unsigned long)scaled;
+}
+
+// Seed of the pseudo-random generators
+static inline uint64_t test_seed(void)
+{
+    const uint64_t seed = (uint64_t)test_env("SPC_TEST_SEED", 1.0);
+    return seed != 0 ? seed : 1;
+}
+
+// xorshift64*, fast and good enough to drive the fuzzers
+static inline uint64_t test_rand(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// Random number in [0, bound)
+static inline unsigned int test_rand_below(uint64_t* state, const unsigned int bound)
+{
+    return (unsigned int)((test_rand(state) >> 32) % bound);
+}
+
+// Print the throughput of a run in millions per second and compare it with the floor read from env,
+// returns 0 when it is fast enough
+static inline int test_throughput(const char* what, const double count, const double seconds, const char* env,
+                                  const double floor_default)
+{
+    const double rate = seconds > 0.0 ? count / seconds / 1e6 : 0.0;
+    const double floor = test_env(env, floor_default * TEST_FLOOR_SCALE);
+    printf("%s: %.0f in %.3f s, %.3f M/s (floor %.3f M/s, %s)\n", what, count, seconds, rate, floor, env);
+    if (floor > 0.0 && rate < floor)
+    {
+        printf("FAIL %s: throughput below the floor\n", what);
+        return 1;
+    }
+    return 0;
+}
+
+#endif // TEST_UTIL_H
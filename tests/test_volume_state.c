@@ -0,0 +1,242 @@
+// Test of the shared volume state and the mixer watcher.
+// The cache part checks the device and mixer levels, the hand-over of applies and the resync a settled apply
+// requests when the device shows another volume. The watcher part runs volume_watch_start against a fake amixer
+// placed first in PATH: "amixer events" prints what the test writes into a FIFO and "amixer get" answers with the
+// next level of a list. Only value events of the followed control may read the level back ("Master" is not
+// "Master Mono"), a level within the tolerance or one the mixer thread is applying is not an external change, and
+// every real change must notify. Starting the watcher without an amixer must fail.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../volume_state.h"
+#include "test_util.h"
+
+static char dir[64]; // Holds the fake amixer, its FIFO, the levels it answers with and its log
+static char path_env[4096]; // PATH with dir first
+static atomic_uint notified;
+static int events = -1; // Write end of the FIFO "amixer events" prints
+
+static void notify(void)
+{
+    atomic_fetch_add(&notified, 1);
+}
+
+// Write a file in dir
+static int write_file(const char* name, const char* text)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        return 1;
+    }
+    fputs(text, file);
+    fclose(file);
+    return 0;
+}
+
+// Number of "amixer get" calls so far, all of them must have been for control
+static int gets(const char* control)
+{
+    char path[96];
+    snprintf(path, sizeof(path), "%s/gets", dir);
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return 0;
+    }
+    int count = 0;
+    char line[96];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        count += strcmp(line, control) == 0 ? 1 : 1000;
+    }
+    fclose(file);
+    return count;
+}
+
+// Wait up to two seconds for an external change to be handed over, returns its level or VOLUME_UNKNOWN
+static int wait_resync(void)
+{
+    int volume = VOLUME_UNKNOWN;
+    for (int tries = 0; tries < 2000 && !volume_state_take_resync(&volume); tries++)
+    {
+        usleep(1000);
+    }
+    return volume;
+}
+
+static int check_cache(void)
+{
+    int volume = 0;
+    struct timespec when = {0};
+    TEST_CHECK(volume_state_mixer() == VOLUME_UNKNOWN && volume_state_device() == VOLUME_UNKNOWN, "unknown levels");
+    TEST_CHECK(!volume_state_take_resync(&volume) && volume_state_take_applied(&volume, &when) == 0, "empty state");
+
+    // Nothing on the device yet, an apply needs no resync but is handed over and notified
+    const struct timespec first = {1, 100};
+    volume_state_applying(40);
+    volume_state_applied(40, 1, &first);
+    TEST_CHECK(volume_state_mixer() == 40 && !volume_state_take_resync(&volume), "apply without a device level");
+    TEST_CHECK(volume_state_take_applied(&volume, &when) == 1 && volume == 40 && when.tv_sec == 1 &&
+               when.tv_nsec == 100, "taken apply");
+    TEST_CHECK(volume_state_take_applied(&volume, &when) == 0, "apply taken twice");
+    TEST_CHECK(atomic_load(&notified) == 1, "%u notifications", atomic_load(&notified));
+
+    // A settled apply brings a device at another volume along, an unsettled one leaves it to the newer sample
+    volume_state_set_device(30);
+    TEST_CHECK(volume_state_device() == 30, "device level");
+    const struct timespec later = {2, 0};
+    volume_state_applied(41, 0, &later);
+    TEST_CHECK(!volume_state_take_resync(&volume), "unsettled apply resynchronizes");
+    volume_state_applied(42, 1, &later);
+    TEST_CHECK(volume_state_take_resync(&volume) && volume == 42, "settled apply does not resynchronize");
+    TEST_CHECK(!volume_state_take_resync(&volume), "resync taken twice");
+    TEST_CHECK(volume_state_take_applied(&volume, &when) == 2 && volume == 42 && when.tv_sec == 2, "applies merged");
+    volume_state_applied(30, 1, &later);
+    TEST_CHECK(!volume_state_take_resync(&volume), "device already at the applied volume");
+    volume_state_take_applied(&volume, &when);
+    TEST_CHECK(atomic_load(&notified) == 4, "%u notifications", atomic_load(&notified));
+    printf("cache: device and mixer levels, applies and resyncs\n");
+    return 0;
+}
+
+static int check_missing_amixer(void)
+{
+    // Neither stdbuf nor amixer can be found
+    setenv("PATH", dir, 1);
+    const int failed = volume_watch_start("Master");
+    setenv("PATH", path_env, 1);
+    TEST_CHECK(failed != 0, "watcher started without an amixer");
+    printf("missing amixer reported\n");
+    return 0;
+}
+
+// Send event lines to the watcher
+static int send_events(const char* lines)
+{
+    const size_t len = strlen(lines);
+    return write(events, lines, len) == (ssize_t)len ? 0 : 1;
+}
+
+static int check_watch(void)
+{
+    char fifo[96];
+    snprintf(fifo, sizeof(fifo), "%s/events", dir);
+    TEST_CHECK(mkfifo(fifo, 0600) == 0, "mkfifo %s", fifo);
+    TEST_CHECK(write_file("levels", "20\n") == 0, "levels");
+    TEST_CHECK(volume_watch_start("Master") == 0, "watcher start");
+    TEST_CHECK(volume_state_mixer() == 20, "primed level %d", volume_state_mixer());
+    // The fake amixer opens the FIFO once it runs
+    for (int tries = 0; tries < 2000 && events < 0; tries++)
+    {
+        events = open(fifo, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (events < 0)
+        {
+            TEST_CHECK(errno == ENXIO, "open %s", fifo);
+            usleep(1000);
+        }
+    }
+    TEST_CHECK(events >= 0, "amixer events did not open %s", fifo);
+
+    // Another application changes the volume
+    unsigned int before = atomic_load(&notified);
+    TEST_CHECK(write_file("levels", "60\n") == 0, "levels");
+    TEST_CHECK(send_events("event value: 'Master Playback Volume':value=60\n") == 0, "events");
+    int volume = wait_resync();
+    TEST_CHECK(volume == 60 && volume_state_mixer() == 60, "external change to 60 gave %d", volume);
+    TEST_CHECK(atomic_load(&notified) == before + 1, "external change not notified");
+
+    // Other elements, other event types, a level within the tolerance and the mixer thread's own apply are no
+    // external changes. Only the last event is one, it can only be taken after the others are handled
+    before = atomic_load(&notified);
+    volume_state_applying(75);
+    TEST_CHECK(write_file("levels", "61\n75\n30\n90\n") == 0, "levels");
+    TEST_CHECK(send_events("event info: 'Master Playback Volume'\n"
+                           "event value: 'Master Mono Playback Volume'\n"
+                           "event value: 'Headphone Playback Volume'\n"
+                           "event value: 'Master Playback Switch'\n"
+                           "event value: 'Master'\n"
+                           "event value: 'Master Playback Volume'\n") == 0, "events");
+    volume = wait_resync();
+    TEST_CHECK(volume == 30, "external change to 30 gave %d", volume);
+    // An element wrongly taken for the control would read 90 back after the change
+    usleep(100000);
+    TEST_CHECK(atomic_load(&notified) == before + 1, "%u notifications, expected 1", atomic_load(&notified) - before);
+    TEST_CHECK(gets("Master") == 5, "level read back %d times, expected 5", gets("Master"));
+
+    // An apply of the knob is newer than an external change not yet taken
+    TEST_CHECK(write_file("levels", "50\n") == 0, "levels");
+    TEST_CHECK(send_events("event value: 'Master Playback Volume'\n") == 0, "events");
+    for (int tries = 0; tries < 2000 && volume_state_mixer() != 50; tries++)
+    {
+        usleep(1000);
+    }
+    TEST_CHECK(volume_state_mixer() == 50, "external change to 50 not seen");
+    const struct timespec when = {3, 0};
+    volume_state_applied(55, 0, &when);
+    TEST_CHECK(!volume_state_take_resync(&volume), "external change %d survived an apply", volume);
+
+    // The events end before the watcher is stopped, which it reports
+    close(events);
+    events = -1;
+    usleep(100000);
+    volume_watch_stop();
+    remove(fifo);
+    printf("watcher: followed control only, tolerance, own applies and notifications\n");
+    return 0;
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    volume_state_set_notify(notify);
+    snprintf(dir, sizeof(dir), "/tmp/spc_volume_state_%d", (int)getpid());
+    TEST_CHECK(mkdir(dir, 0700) == 0, "mkdir %s", dir);
+    snprintf(path_env, sizeof(path_env), "%s:%s", dir,
+             getenv("PATH") != nullptr ? getenv("PATH") : "/usr/bin:/bin");
+
+    // "get" answers with the first line of levels and logs the control, "events" prints the FIFO
+    char script[1024];
+    snprintf(script, sizeof(script),
+             "#!/bin/sh\n"
+             "case \"$1\" in\n"
+             "get)\n"
+             "    level=$(head -n 1 '%1$s/levels')\n"
+             "    sed -i 1d '%1$s/levels'\n"
+             "    echo \"$2\" >> '%1$s/gets'\n"
+             "    printf \"Simple mixer control '%%s',0\\n  Mono: Playback 40 [%%s%%%%] [on]\\n\" \"$2\" \"$level\" ;;\n"
+             "events)\n"
+             "    exec cat '%1$s/events' ;;\n"
+             "esac\n", dir);
+    char amixer[96];
+    snprintf(amixer, sizeof(amixer), "%s/amixer", dir);
+
+    int failed = check_cache() || check_missing_amixer();
+    if (!failed)
+    {
+        failed = write_file("amixer", script) || chmod(amixer, 0700) != 0;
+        setenv("PATH", path_env, 1);
+        failed = failed || check_watch();
+    }
+    volume_watch_stop();
+    remove(amixer);
+    char path[96];
+    snprintf(path, sizeof(path), "%s/levels", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/gets", dir);
+    remove(path);
+    snprintf(path, sizeof(path), "%s/events", dir);
+    remove(path);
+    rmdir(dir);
+    return failed;
+}
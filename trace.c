@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+static FILE* trace_file = nullptr; // Trace output, nullptr when tracing is disabled
+static int trace_first = 1; // No event has been written yet
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards the two above, both threads write events
+static atomic_bool trace_enabled = false; // Lock-free hint that a file is open, trace_file is checked under the mutex
+
+// Convert a timespec to microseconds, the unit of the trace event format
+static double trace_us(const struct timespec* ts)
+{
+    return (double)ts->tv_sec * 1e6 + (double)ts->tv_nsec / 1e3;
+}
+
+void trace_now(struct timespec* ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+double trace_diff_ms(const struct timespec* start, const struct timespec* end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e3 + (double)(end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+int trace_open(const char* path)
+{
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != nullptr)
+    {
+        pthread_mutex_unlock(&trace_mutex);
+        return 1;
+    }
+    trace_file = fopen(path, "w");
+    if (trace_file == nullptr)
+    {
+        pthread_mutex_unlock(&trace_mutex);
+        return 1;
+    }
+    trace_first = 1;
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    atomic_store(&trace_enabled, true);
+    pthread_mutex_unlock(&trace_mutex);
+    return 0;
+}
+
+int trace_is_open(void)
+{
+    return atomic_load(&trace_enabled);
+}
+
+// Write one event, the fields specific to the event phase are passed preformatted in tail. The file may have been
+// closed or replaced by a reload since the caller checked trace_enabled
+static void trace_event(const char* name, const double ts, const char* tail)
+{
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_file != nullptr)
+    {
+        fprintf(trace_file, "%s{\"name\":\"%s\",\"cat\":\"sample\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,%s}",
+                trace_first ? "" : ",\n", name, getpid(), gettid(), ts, tail);
+        trace_first = 0;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_span(const char* name, unsigned int seq, const struct timespec* start, const struct timespec* end)
+{
+    if (!atomic_load(&trace_enabled))
+    {
+        return;
+    }
+    char tail[80];
+    snprintf(tail, sizeof(tail), "\"ph\":\"X\",\"dur\":%.3f,\"args\":{\"seq\":%u}", trace_us(end) - trace_us(start),
+             seq);
+    trace_event(name, trace_us(start), tail);
+}
+
+void trace_sample(unsigned int seq, const struct timespec* start, const struct timespec* end)
+{
+    if (!atomic_load(&trace_enabled))
+    {
+        return;
+    }
+    // Async begin/end pair, the viewer draws it on its own track spanning both threads
+    char tail[48];
+    snprintf(tail, sizeof(tail), "\"ph\":\"b\",\"id\":%u", seq);
+    trace_event("sample", trace_us(start), tail);
+    snprintf(tail, sizeof(tail), "\"ph\":\"e\",\"id\":%u", seq);
+    trace_event("sample", trace_us(end), tail);
+}
+
+void trace_close(void)
+{
+    pthread_mutex_lock(&trace_mutex);
+    atomic_store(&trace_enabled, false);
+    if (trace_file != nullptr)
+    {
+        fprintf(trace_file, "\n]}\n");
+        fclose(trace_file);
+        trace_file = nullptr;
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+// Sample latency tracing.
+// Every framed sample carries the CLOCK_MONOTONIC time at which its bytes were read from the UART.
+// When a trace file is opened, per-stage spans (read, frame, parse, enqueue, apply) and one async
+// span covering the whole life of each sample are written in the Chrome trace event JSON format,
+// which can be loaded into chrome://tracing or https://ui.perfetto.dev.
+
+// Read the current CLOCK_MONOTONIC time
+void trace_now(struct timespec* ts);
+
+// Difference end - start in milliseconds
+double trace_diff_ms(const struct timespec* start, const struct timespec* end);
+
+// Open the trace file, returns 0 on success and 1 on failure
+int trace_open(const char* path);
+
+// Check whether a trace file is open
+int trace_is_open(void);
+
+// Record one stage of sample processing on the calling thread
+void trace_span(const char* name, unsigned int seq, const struct timespec* start, const struct timespec* end);
+
+// Record the whole life of a sample, from the UART read to the mixer apply
+void trace_sample(unsigned int seq, const struct timespec* start, const struct timespec* end);
+
+// Finish the JSON document and close the trace file
+void trace_close(void);
+
+#endif // TRACE_H
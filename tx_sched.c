@@ -0,0 +1,199 @@
+#include "tx_sched.h"
+#include <string.h>
+#include <time.h>
+
+struct tx_message
+{
+    char data[TX_MESSAGE_MAX];
+    size_t len;
+};
+
+// Messages of one priority, a ring
+struct tx_queue
+{
+    struct tx_message items[TX_QUEUE_MESSAGES];
+    size_t head;
+    size_t count;
+};
+
+static const bool tx_supersedes[TX_PRIORITY_COUNT] = {
+    [TX_PRIORITY_CONTROL] = false,
+    [TX_PRIORITY_VOLUME] = true,
+};
+
+static struct tx_queue tx_queues[TX_PRIORITY_COUNT];
+static struct tx_message tx_current; // Message being sent
+static enum tx_priority tx_current_priority;
+static size_t tx_current_sent; // Bytes of tx_current already sent, equal to its length when there is none
+static tx_sink tx_output = nullptr;
+static double tx_rate = 11520.0; // Bytes per second, 115200 baud with 10 bits per byte
+static double tx_budget = 32.0; // Bucket depth in bytes
+static double tx_tokens = 32.0; // Bytes that may be sent right now
+static struct timespec tx_refilled; // When tx_tokens was last brought up to date
+static struct tx_stats tx_stats;
+
+void tx_set_sink(const tx_sink sink)
+{
+    tx_output = sink;
+}
+
+void tx_configure(const unsigned int rate, const unsigned int budget)
+{
+    tx_rate = rate > 0 ? (double)rate : 1.0;
+    tx_budget = budget == 0 ? 1.0 : budget > TX_BUDGET_MAX ? TX_BUDGET_MAX : (double)budget;
+    if (tx_tokens > tx_budget)
+    {
+        tx_tokens = tx_budget;
+    }
+}
+
+bool tx_send(const enum tx_priority priority, const char* data, const size_t len)
+{
+    struct tx_queue* queue = &tx_queues[priority];
+    if (len == 0 || len > TX_MESSAGE_MAX)
+    {
+        return false;
+    }
+    if (tx_supersedes[priority] && queue->count > 0)
+    {
+        // Only the newest one matters, take over the slot of the one waiting
+        struct tx_message* last = &queue->items[(queue->head + queue->count - 1) % TX_QUEUE_MESSAGES];
+        memcpy(last->data, data, len);
+        last->len = len;
+        tx_stats.superseded++;
+        return true;
+    }
+    if (queue->count == TX_QUEUE_MESSAGES)
+    {
+        return false;
+    }
+    struct tx_message* slot = &queue->items[(queue->head + queue->count) % TX_QUEUE_MESSAGES];
+    memcpy(slot->data, data, len);
+    slot->len = len;
+    queue->count++;
+    return true;
+}
+
+void tx_clear(const enum tx_priority priority)
+{
+    tx_queues[priority].count = 0;
+}
+
+bool tx_idle(void)
+{
+    if (tx_current_sent < tx_current.len)
+    {
+        return false;
+    }
+    for (int priority = 0; priority < TX_PRIORITY_COUNT; priority++)
+    {
+        if (tx_queues[priority].count > 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Start the next message, highest priority first, returns false when nothing is waiting
+static bool tx_next(void)
+{
+    for (int priority = 0; priority < TX_PRIORITY_COUNT; priority++)
+    {
+        struct tx_queue* queue = &tx_queues[priority];
+        if (queue->count > 0)
+        {
+            tx_current = queue->items[queue->head];
+            tx_current_priority = (enum tx_priority)priority;
+            tx_current_sent = 0;
+            queue->head = (queue->head + 1) % TX_QUEUE_MESSAGES;
+            queue->count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Add the tokens earned since the last refill
+static void tx_refill(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed =
+        (double)(now.tv_sec - tx_refilled.tv_sec) + (double)(now.tv_nsec - tx_refilled.tv_nsec) / 1e9;
+    tx_refilled = now;
+    tx_tokens += elapsed * tx_rate;
+    if (tx_tokens > tx_budget)
+    {
+        tx_tokens = tx_budget;
+    }
+}
+
+int tx_pump(void)
+{
+    if (tx_idle())
+    {
+        return 0;
+    }
+    tx_refill();
+    // Everything allowed now goes out in one write
+    char out[TX_BUDGET_MAX];
+    size_t len = 0;
+    while (tx_tokens >= 1.0 && len < sizeof(out))
+    {
+        if (tx_current_sent == tx_current.len && !tx_next())
+        {
+            break;
+        }
+        out[len++] = tx_current.data[tx_current_sent++];
+        tx_tokens -= 1.0;
+        if (tx_current_sent == tx_current.len)
+        {
+            tx_stats.messages[tx_current_priority]++;
+        }
+    }
+    if (!tx_idle())
+    {
+        tx_stats.throttled++;
+    }
+    if (len == 0)
+    {
+        return 0;
+    }
+    tx_stats.bytes += len;
+    return tx_output != nullptr ? tx_output(out, len) : 1;
+}
+
+int tx_finish(const unsigned int timeout_ms)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!tx_idle())
+    {
+        if (tx_pump() != 0)
+        {
+            return 1;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const double waited_ms =
+            (double)(now.tv_sec - start.tv_sec) * 1e3 + (double)(now.tv_nsec - start.tv_nsec) / 1e6;
+        if (waited_ms > timeout_ms)
+        {
+            return 1;
+        }
+        if (!tx_idle())
+        {
+            // Sleep until about one more byte is allowed
+            const double byte_ns = 1e9 / tx_rate;
+            const struct timespec pause = {0, byte_ns < 999999999.0 ? (long)byte_ns + 1 : 999999999};
+            nanosleep(&pause, nullptr);
+        }
+    }
+    return 0;
+}
+
+struct tx_stats tx_get_stats(void)
+{
+    return tx_stats;
+}
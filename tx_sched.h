@@ -0,0 +1,61 @@
+#ifndef TX_SCHED_H
+#define TX_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Scheduler of the bytes sent to the device.
+// Messages wait in one queue per priority and the highest priority goes first, so control bytes (handshake,
+// reset) overtake volume echoes. A message is never split by another one, the device would see garbage. A newer
+// volume echo replaces the one still waiting, the device only needs the latest level. Sending is paced by a
+// token bucket: bytes go out at the configured rate with bursts of at most the device's RX budget, so the
+// device's receive buffer cannot overflow. Used from the main thread only.
+
+#define TX_MESSAGE_MAX 8 // Longest message, "100" and its end byte fit easily
+#define TX_QUEUE_MESSAGES 8 // Messages waiting per priority
+#define TX_BUDGET_MAX 256 // Largest RX budget
+
+enum tx_priority
+{
+    TX_PRIORITY_CONTROL, // Handshake and reset, never dropped
+    TX_PRIORITY_VOLUME, // Volume echoes, a newer one supersedes the waiting one
+    TX_PRIORITY_COUNT
+};
+
+// Writes bytes to the port, returns 0 on success and 1 on failure
+typedef int (*tx_sink)(const char* data, size_t len);
+
+struct tx_stats
+{
+    unsigned long bytes; // Bytes handed to the sink
+    unsigned long messages[TX_PRIORITY_COUNT]; // Messages sent, per priority
+    unsigned long superseded; // Volume echoes replaced before they were sent
+    unsigned long throttled; // Pumps that left bytes waiting for the bucket to refill
+};
+
+// Where the bytes go, the port before and after the I/O engine is attached, the engine in between
+void tx_set_sink(tx_sink sink);
+
+// Pacing, rate in bytes per second and budget in bytes the device can take at once
+void tx_configure(unsigned int rate, unsigned int budget);
+
+// Queue a message, returns false when it does not fit (too long or the queue of its priority is full)
+bool tx_send(enum tx_priority priority, const char* data, size_t len);
+
+// Drop the waiting messages of one priority, a message already being sent is finished
+void tx_clear(enum tx_priority priority);
+
+// True when nothing is waiting to be sent
+bool tx_idle(void);
+
+// Send what the bucket allows, returns 0 on success and 1 when the sink failed
+int tx_pump(void);
+
+// Send everything that is waiting, sleeping while the bucket refills. Returns 0 once all was sent, 1 when the
+// sink failed or timeout_ms passed
+int tx_finish(unsigned int timeout_ms);
+
+// Current counters
+struct tx_stats tx_get_stats(void);
+
+#endif // TX_SCHED_H
@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+#include "volume_state.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything below
+static int state_mixer = VOLUME_UNKNOWN; // Last level applied to or observed on the mixer
+static int state_device = VOLUME_UNKNOWN; // Last volume sent to the device
+static int state_resync = VOLUME_UNKNOWN; // External mixer change not yet sent to the device
+static int state_applying = VOLUME_UNKNOWN; // Level the mixer thread is setting right now
+static int state_applied = VOLUME_UNKNOWN; // Newest level applied by the mixer thread and not yet taken
+static struct timespec state_applied_at; // When it was applied
+static unsigned long state_applied_count = 0; // Applies not yet taken
+static atomic_bool state_applied_ready = false; // Set with state_applied_count, read without the mutex
+static char watch_control[64] = "Master"; // Control whose changes are followed
+static void (*state_notify)(void) = nullptr; // Called after an external change or an apply
+
+static pid_t watch_pid = -1; // "amixer events" child
+static int watch_fd = -1; // Read end of its stdout, owned by the watcher thread while it runs
+static pthread_t watch_thread;
+static int watch_running = 0;
+static atomic_bool watch_stopping = false; // Set by volume_watch_stop, the end of the events is expected
+
+void volume_state_set_notify(void (*notify)(void))
+{
+    pthread_mutex_lock(&state_mutex);
+    state_notify = notify;
+    pthread_mutex_unlock(&state_mutex);
+}
+
+int volume_state_mixer(void)
+{
+    pthread_mutex_lock(&state_mutex);
+    const int volume = state_mixer;
+    pthread_mutex_unlock(&state_mutex);
+    return volume;
+}
+
+void volume_state_set_mixer(const int volume)
+{
+    pthread_mutex_lock(&state_mutex);
+    state_mixer = volume;
+    pthread_mutex_unlock(&state_mutex);
+}
+
+int volume_state_device(void)
+{
+    pthread_mutex_lock(&state_mutex);
+    const int volume = state_device;
+    pthread_mutex_unlock(&state_mutex);
+    return volume;
+}
+
+void volume_state_set_device(const int volume)
+{
+    pthread_mutex_lock(&state_mutex);
+    state_device = volume;
+    pthread_mutex_unlock(&state_mutex);
+}
+
+void volume_state_applying(const int volume)
+{
+    pthread_mutex_lock(&state_mutex);
+    state_applying = volume;
+    pthread_mutex_unlock(&state_mutex);
+}
+
+void volume_state_applied(const int volume, const int settled, const struct timespec* when)
+{
+    pthread_mutex_lock(&state_mutex);
+    state_applied = volume;
+    state_applied_at = *when;
+    state_applied_count++;
+    atomic_store_explicit(&state_applied_ready, true, memory_order_relaxed);
+    state_mixer = volume;
+    state_applying = VOLUME_UNKNOWN;
+    state_resync = VOLUME_UNKNOWN;
+    if (settled && state_device != VOLUME_UNKNOWN && state_device != volume)
+    {
+        state_resync = volume;
+    }
+    void (*notify)(void) = state_notify;
+    pthread_mutex_unlock(&state_mutex);
+    if (notify != nullptr)
+    {
+        notify();
+    }
+}
+
+unsigned long volume_state_take_applied(int* volume, struct timespec* when)
+{
+    // Missing an apply that is being recorded right now only delays it to the next call
+    if (!atomic_load_explicit(&state_applied_ready, memory_order_relaxed))
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&state_mutex);
+    const unsigned long count = state_applied_count;
+    *volume = state_applied;
+    *when = state_applied_at;
+    state_applied_count = 0;
+    atomic_store_explicit(&state_applied_ready, false, memory_order_relaxed);
+    pthread_mutex_unlock(&state_mutex);
+    return count;
+}
+
+int volume_state_take_resync(int* volume)
+{
+    pthread_mutex_lock(&state_mutex);
+    const int pending = state_resync;
+    state_resync = VOLUME_UNKNOWN;
+    pthread_mutex_unlock(&state_mutex);
+    if (pending == VOLUME_UNKNOWN)
+    {
+        return 0;
+    }
+    *volume = pending;
+    return 1;
+}
+
+int volume_state_read_mixer(const char* control)
+{
+    char command[96];
+    snprintf(command, sizeof(command), "amixer get '%s' 2>/dev/null", control);
+    FILE* output = popen(command, "r");
+    if (output == nullptr)
+    {
+        return VOLUME_UNKNOWN;
+    }
+    // The first "[NN%]" is the level of the first channel
+    int volume = VOLUME_UNKNOWN;
+    char line[256];
+    while (volume == VOLUME_UNKNOWN && fgets(line, sizeof(line), output) != nullptr)
+    {
+        const char* open = strchr(line, '[');
+        while (open != nullptr)
+        {
+            int parsed;
+            char percent;
+            if (sscanf(open, "[%d%c]", &parsed, &percent) == 2 && percent == '%')
+            {
+                volume = parsed;
+                break;
+            }
+            open = strchr(open + 1, '[');
+        }
+    }
+    pclose(output);
+    return volume;
+}
+
+void volume_watch_set_control(const char* control)
+{
+    pthread_mutex_lock(&state_mutex);
+    snprintf(watch_control, sizeof(watch_control), "%s", control);
+    pthread_mutex_unlock(&state_mutex);
+}
+
+// Read back the level after an event and keep it if somebody else changed it
+static void volume_watch_check(void)
+{
+    char control[sizeof(watch_control)];
+    pthread_mutex_lock(&state_mutex);
+    strcpy(control, watch_control);
+    pthread_mutex_unlock(&state_mutex);
+
+    const int volume = volume_state_read_mixer(control);
+    if (volume == VOLUME_UNKNOWN)
+    {
+        return;
+    }
+    pthread_mutex_lock(&state_mutex);
+    // The event of our own apply can arrive before the mixer thread records it
+    const int ours = state_applying != VOLUME_UNKNOWN && abs(volume - state_applying) <= VOLUME_STATE_TOLERANCE;
+    void (*notify)(void) = nullptr;
+    if (!ours && (state_mixer == VOLUME_UNKNOWN || abs(volume - state_mixer) > VOLUME_STATE_TOLERANCE))
+    {
+        state_mixer = volume;
+        state_resync = volume;
+        notify = state_notify;
+    }
+    pthread_mutex_unlock(&state_mutex);
+    if (notify != nullptr)
+    {
+        notify();
+    }
+}
+
+// Element suffixes of a simple control, "Master" is "Master Playback Volume", "Master Playback Switch", ...
+static const char* watch_suffixes[] = {
+    "", " Playback Volume", " Playback Switch", " Capture Volume", " Capture Switch", " Volume", " Switch",
+};
+
+// True when the quoted element name of an event line belongs to the control, "Master" does not match "Master Mono"
+static int volume_watch_matches(const char* line, const char* control)
+{
+    const char* name = strchr(line, '\'');
+    if (name == nullptr)
+    {
+        return 0;
+    }
+    name++;
+    const char* end = strchr(name, '\'');
+    const size_t control_len = strlen(control);
+    if (end == nullptr || (size_t)(end - name) < control_len || strncmp(name, control, control_len) != 0)
+    {
+        return 0;
+    }
+    const char* suffix = name + control_len;
+    const size_t suffix_len = (size_t)(end - suffix);
+    for (size_t i = 0; i < sizeof(watch_suffixes) / sizeof(watch_suffixes[0]); i++)
+    {
+        if (strlen(watch_suffixes[i]) == suffix_len && strncmp(suffix, watch_suffixes[i], suffix_len) == 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reads the events from the descriptor it is given and closes it, watch_fd is only touched by start and stop
+static void* volume_watch_thread(void* arg)
+{
+    pthread_setname_np(pthread_self(), "BPC_SPC_Mixer_Watch");
+    FILE* events = fdopen((int)(intptr_t)arg, "r");
+    if (events == nullptr)
+    {
+        close((int)(intptr_t)arg);
+        return nullptr;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), events) != nullptr)
+    {
+        // Only value changes of the followed control matter, e.g. "event value: 'Master Playback Volume' ..."
+        if (strncmp(line, "event value", 11) != 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&state_mutex);
+        const int ours = volume_watch_matches(line, watch_control);
+        pthread_mutex_unlock(&state_mutex);
+        if (ours)
+        {
+            volume_watch_check();
+        }
+    }
+    fclose(events);
+    if (!atomic_load(&watch_stopping))
+    {
+        printf("amixer events ended, external volume changes will not reach the device\n");
+    }
+    return nullptr;
+}
+
+int volume_watch_start(const char* control)
+{
+    if (watch_running)
+    {
+        return 0;
+    }
+    volume_watch_set_control(control);
+    volume_state_set_mixer(volume_state_read_mixer(control));
+
+    // Close on exec, amixer processes started later must not hold the pipes open. The status pipe is closed by a
+    // successful exec and carries the errno of a failed one
+    int fds[2];
+    int status[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        return 1;
+    }
+    if (pipe2(status, O_CLOEXEC) != 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    watch_pid = fork();
+    if (watch_pid < 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        close(status[0]);
+        close(status[1]);
+        return 1;
+    }
+    if (watch_pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO); // The duplicate does not inherit close on exec
+        close(fds[0]);
+        close(fds[1]);
+        execlp("stdbuf", "stdbuf", "-oL", "amixer", "events", (char*)nullptr);
+        execlp("amixer", "amixer", "events", (char*)nullptr);
+        const int error = errno;
+        const ssize_t written = write(status[1], &error, sizeof(error));
+        (void)written;
+        _exit(127);
+    }
+    close(fds[1]);
+    close(status[1]);
+    int error = 0;
+    ssize_t got;
+    do
+    {
+        got = read(status[0], &error, sizeof(error));
+    }
+    while (got < 0 && errno == EINTR);
+    close(status[0]);
+    if (got == sizeof(error))
+    {
+        printf("Unable to run amixer events: %s\n", strerror(error));
+        close(fds[0]);
+        waitpid(watch_pid, nullptr, 0);
+        watch_pid = -1;
+        return 1;
+    }
+    watch_fd = fds[0];
+    atomic_store(&watch_stopping, false);
+    if (pthread_create(&watch_thread, nullptr, volume_watch_thread, (void*)(intptr_t)watch_fd) != 0)
+    {
+        volume_watch_stop();
+        return 1;
+    }
+    watch_running = 1;
+    return 0;
+}
+
+void volume_watch_stop(void)
+{
+    // The watcher thread sees end of file once the child is gone
+    atomic_store(&watch_stopping, true);
+    if (watch_pid > 0)
+    {
+        kill(watch_pid, SIGTERM);
+        waitpid(watch_pid, nullptr, 0);
+        watch_pid = -1;
+    }
+    // A running watcher closes the descriptor itself
+    if (watch_running)
+    {
+        pthread_join(watch_thread, nullptr);
+        watch_running = 0;
+    }
+    else if (watch_fd >= 0)
+    {
+        close(watch_fd);
+    }
+    watch_fd = -1;
+}
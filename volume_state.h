@@ -0,0 +1,61 @@
+#ifndef VOLUME_STATE_H
+#define VOLUME_STATE_H
+
+#include <time.h>
+
+// Shared volume state.
+// Records the last level applied to (or observed on) the mixer and the last volume sent to the device, so that
+// both paths can skip work that would not change anything. A watcher thread follows "amixer events" and reads
+// the level back only when the mixer reports a change. A change made by another application is stored and handed
+// to the main loop, which resynchronizes the device with it. The applies of the mixer thread are handed to the
+// main loop the same way, which publishes them in the telemetry. Both call the notify function, so that a main loop
+// waiting for the port picks them up at once.
+
+#define VOLUME_UNKNOWN -1 // No level known yet
+#define VOLUME_STATE_TOLERANCE 1 // Read-back differing by this much from the requested level is rounding, not a change
+
+// Function called without locks held after an external change or an apply was recorded, nullptr for none
+void volume_state_set_notify(void (*notify)(void));
+
+// Last level applied to or observed on the mixer
+int volume_state_mixer(void);
+
+// Record a level applied to the mixer
+void volume_state_set_mixer(int volume);
+
+// Last volume sent to the device
+int volume_state_device(void);
+
+// Record a volume sent to the device
+void volume_state_set_device(int volume);
+
+// Announce a level the mixer thread is about to apply, VOLUME_UNKNOWN when the apply failed. Until
+// volume_state_applied, reading this level back is not mistaken for a change made by another application
+void volume_state_applying(int volume);
+
+// Record a level the mixer thread applied for the knob at the time when. The knob is newer than any pending
+// external change, which is dropped. Once settled (nothing more queued), a device left at another level is
+// resynchronized to this one
+void volume_state_applied(int volume, int settled, const struct timespec* when);
+
+// Take the applies recorded since the last call, returns their number and stores the newest level and its time,
+// 0 when there were none. Cheap when there is nothing to take, the main loop calls it every iteration
+unsigned long volume_state_take_applied(int* volume, struct timespec* when);
+
+// Take a pending external mixer change, returns 1 and stores the level in volume when there is one
+int volume_state_take_resync(int* volume);
+
+// Read the current level of a mixer control with "amixer get", returns VOLUME_UNKNOWN on failure
+int volume_state_read_mixer(const char* control);
+
+// Control whose changes are followed
+void volume_watch_set_control(const char* control);
+
+// Prime the mixer level and start following mixer events, returns 0 on success and 1 on failure, including an
+// "amixer events" that could not be started. The watcher reports when the events end before volume_watch_stop
+int volume_watch_start(const char* control);
+
+// Stop following mixer events
+void volume_watch_stop(void);
+
+#endif // VOLUME_STATE_H